@@ -0,0 +1,127 @@
+#pragma once
+
+#include "cm_ctors.h"
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace utility {
+
+/// @brief Cost of each value is 1, so capacity of the cache is count of values.
+struct TUnitCost
+{
+    template <typename T>
+    std::size_t operator()(const T &) const
+    {
+        return 1u;
+    }
+};
+
+/// @brief Keeps values of total cost up to capacity, least recently used ones are dropped when new
+/// is added. The most recent value is kept even if it alone exceeds capacity.
+/// @note Key is stored once.
+template <typename taKey, typename taValue, typename taHash = std::hash<taKey>,
+          typename taCost = TUnitCost>
+class LruCache
+{
+  public:
+    // Order of use points to the keys of the index.
+    NO_COPYMOVE(LruCache);
+    LruCache() = delete;
+
+    explicit LruCache(std::size_t capacity) :
+        capacity(capacity)
+    {
+    }
+
+    /// @returns value by @p key or nullptr, found value becomes most recently used.
+    const taValue *find(const taKey &key)
+    {
+        const auto it = index.find(key);
+        if (it == index.end())
+        {
+            return nullptr;
+        }
+        lru.splice(lru.begin(), lru, it->second.position);
+        return &it->second.value;
+    }
+
+    /// @brief Adds or replaces @p value of the @p key.
+    const taValue &insert(const taKey &key, taValue value)
+    {
+        auto it = index.find(key);
+        if (it != index.end())
+        {
+            totalCost -= taCost{}(it->second.value);
+            totalCost += taCost{}(value);
+            it->second.value = std::move(value);
+            lru.splice(lru.begin(), lru, it->second.position);
+        }
+        else
+        {
+            totalCost += taCost{}(value);
+            it = index.emplace(key, TNode{std::move(value), {}}).first;
+            // Nodes of the unordered_map are not moved by rehash, so key's address is stable.
+            lru.push_front(&it->first);
+            it->second.position = lru.begin();
+        }
+
+        while (totalCost > capacity && lru.size() > 1)
+        {
+            const auto evicted = index.find(*lru.back());
+            totalCost -= taCost{}(evicted->second.value);
+            lru.pop_back();
+            index.erase(evicted);
+            ++evictionsCount;
+        }
+        return it->second.value;
+    }
+
+    [[nodiscard]]
+    std::size_t size() const
+    {
+        return lru.size();
+    }
+
+    /// @returns total cost of the kept values.
+    [[nodiscard]]
+    std::size_t cost() const
+    {
+        return totalCost;
+    }
+
+    /// @returns count of values dropped to fit capacity since creation.
+    [[nodiscard]]
+    std::size_t evictions() const
+    {
+        return evictionsCount;
+    }
+
+    void clear()
+    {
+        index.clear();
+        lru.clear();
+        totalCost = 0u;
+    }
+
+  private:
+    // Most recently used first.
+    using TLru = std::list<const taKey *>;
+
+    struct TNode
+    {
+        taValue value;
+        typename TLru::iterator position;
+    };
+
+    std::size_t capacity;
+    std::size_t totalCost{0u};
+    std::size_t evictionsCount{0u};
+    TLru lru;
+    std::unordered_map<taKey, TNode, taHash> index;
+};
+} // namespace utility
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+namespace utility {
+
+/// @brief Maps fixed set of string keys to values by single hash and single compare. Hash seed
+/// which gives no collisions is searched at compile time, so lookup is branch free dispatch.
+template <typename taValue, std::size_t taSlots>
+class PerfectKeyMap
+{
+    static_assert(taSlots > 0u && (taSlots & (taSlots - 1u)) == 0u,
+                  "Slots count must be power of 2.");
+
+  public:
+    struct TEntry
+    {
+        std::string_view key;
+        taValue value;
+    };
+
+    template <std::size_t taKeys>
+    constexpr explicit PerfectKeyMap(const TEntry (&entries)[taKeys]) :
+        seed(findSeed(entries))
+    {
+        for (const auto &entry : entries)
+        {
+            slots[slotOf(entry.key, seed)] = entry;
+        }
+    }
+
+    /// @returns value of the @p key or @p fallback if key is unknown.
+    [[nodiscard]]
+    constexpr taValue find(std::string_view key, taValue fallback) const
+    {
+        const auto &slot = slots[slotOf(key, seed)];
+        return !key.empty() && slot.key == key ? slot.value : fallback;
+    }
+
+  private:
+    static constexpr std::uint32_t kMaxSeed = 100000u;
+
+    std::array<TEntry, taSlots> slots{};
+    std::uint32_t seed{0u};
+
+    /// @brief FNV-1a with high bits folded in, so power of 2 table depends on whole hash.
+    static constexpr std::size_t slotOf(std::string_view key, std::uint32_t seed)
+    {
+        std::uint32_t hash = 2166136261u ^ seed;
+        for (const char c : key)
+        {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 16777619u;
+        }
+        return (hash ^ (hash >> 16u)) & (taSlots - 1u);
+    }
+
+    template <std::size_t taKeys>
+    static constexpr std::uint32_t findSeed(const TEntry (&entries)[taKeys])
+    {
+        static_assert(taKeys <= taSlots, "Too many keys for the slots count.");
+        for (std::uint32_t candidate = 0u; candidate < kMaxSeed; ++candidate)
+        {
+            std::array<bool, taSlots> used{};
+            bool collides = false;
+            for (const auto &entry : entries)
+            {
+                auto &slot = used[slotOf(entry.key, candidate)];
+                collides = collides || slot;
+                slot = true;
+            }
+            if (!collides)
+            {
+                return candidate;
+            }
+        }
+        // Reaching it at compile time is compilation error.
+        throw std::logic_error("No perfect hash seed found, increase slots count.");
+    }
+};
+} // namespace utility
@@ -1,13 +1,49 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
 #include <cstddef>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <thread>
 
 namespace utility {
-using runnerint_t = std::shared_ptr<std::atomic<bool>>;
+
+/// @brief Stop request of the runner. Thread can check it or sleep until it is set.
+class StopFlag
+{
+  public:
+    void store(bool value)
+    {
+        {
+            const std::lock_guard grd(mut);
+            flag = value;
+        }
+        cv.notify_all();
+    }
+
+    explicit operator bool() const
+    {
+        return flag;
+    }
+
+    /// @brief Blocks until stop is requested.
+    void wait() const
+    {
+        std::unique_lock lck(mut);
+        cv.wait(lck, [this]() {
+            return flag.load();
+        });
+    }
+
+  private:
+    std::atomic<bool> flag{false};
+    mutable std::mutex mut;
+    mutable std::condition_variable cv;
+};
+
+using runnerint_t = std::shared_ptr<StopFlag>;
 using runner_f_t = std::function<void(const runnerint_t should_int)>;
 
 // Simple way to execute lambda in thread, in case when shared_ptr is cleared it will send
@@ -16,7 +52,7 @@ using runner_f_t = std::function<void(const runnerint_t should_int)>;
 inline auto startNewRunner(const runner_f_t &func)
 {
     using res_t = std::shared_ptr<std::thread>;
-    auto stop = std::make_shared<std::atomic<bool>>(false);
+    auto stop = std::make_shared<StopFlag>();
     return res_t(new std::thread(func, stop), [stop](auto ptrToDelete) {
         stop->store(true);
         if (ptrToDelete)
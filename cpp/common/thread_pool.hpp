@@ -0,0 +1,93 @@
+#pragma once
+
+#include "cm_ctors.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace utility {
+
+/// @brief Fixed amount of threads executing posted tasks in order of posting.
+/// @note Destructor drops not started tasks and waits for running ones.
+class ThreadPool
+{
+  public:
+    using task_t = std::function<void()>;
+
+    NO_COPYMOVE(ThreadPool);
+    ThreadPool() = delete;
+
+    explicit ThreadPool(std::size_t threadsCount)
+    {
+        threadsCount = std::max<std::size_t>(1u, threadsCount);
+        threads.reserve(threadsCount);
+        for (std::size_t i = 0; i < threadsCount; ++i)
+        {
+            threads.emplace_back([this]() {
+                work();
+            });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            const std::lock_guard grd(mut);
+            stopping = true;
+            tasks.clear();
+        }
+        cv.notify_all();
+        for (auto &thread : threads)
+        {
+            if (thread.joinable())
+            {
+                thread.join();
+            }
+        }
+    }
+
+    void post(task_t task)
+    {
+        {
+            const std::lock_guard grd(mut);
+            tasks.push_back(std::move(task));
+        }
+        cv.notify_one();
+    }
+
+  private:
+    std::mutex mut;
+    std::condition_variable cv;
+    std::deque<task_t> tasks;
+    bool stopping{false};
+    std::vector<std::thread> threads;
+
+    void work()
+    {
+        while (true)
+        {
+            task_t task;
+            {
+                std::unique_lock lck(mut);
+                cv.wait(lck, [this]() {
+                    return stopping || !tasks.empty();
+                });
+                if (stopping)
+                {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+} // namespace utility
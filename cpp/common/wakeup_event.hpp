@@ -0,0 +1,78 @@
+#pragma once
+
+#include "cm_ctors.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+
+namespace utility {
+
+/// @brief Wakes up sleeping thread from other threads (or signal handler) by eventfd.
+/// @details Sleeping thread can also be woken up by input on other file descriptor, like connection
+/// to X server.
+class WakeupEvent
+{
+  public:
+    using TDeadline = std::optional<std::chrono::steady_clock::time_point>;
+
+    NO_COPYMOVE(WakeupEvent);
+
+    WakeupEvent() :
+        fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+    {
+        if (fd < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "Failed to create eventfd.");
+        }
+    }
+
+    ~WakeupEvent()
+    {
+        close(fd);
+    }
+
+    /// @brief Wakes up waiting thread. If nobody waits, next wait() returns immediately.
+    /// @note It is async-signal-safe.
+    void notify() const noexcept
+    {
+        const std::uint64_t one = 1;
+        [[maybe_unused]] const auto written = write(fd, &one, sizeof(one));
+    }
+
+    /// @brief Sleeps until notify(), input on @p extraFd (if not negative) or @p deadline passed.
+    /// Sleeps without limit if there is no deadline.
+    void wait(int extraFd, const TDeadline &deadline) const
+    {
+        std::array<pollfd, 2> fds{{{fd, POLLIN, 0}, {extraFd, POLLIN, 0}}};
+        const nfds_t count = extraFd < 0 ? 1 : 2;
+
+        int timeout = -1;
+        if (deadline)
+        {
+            using namespace std::chrono;
+            const auto left = ceil<milliseconds>(*deadline - steady_clock::now()).count();
+            timeout = static_cast<int>(std::clamp<decltype(left)>(left, 0, kMaxTimeoutMs));
+        }
+
+        if (poll(fds.data(), count, timeout) > 0 && (fds[0].revents & POLLIN) != 0)
+        {
+            std::uint64_t value = 0;
+            [[maybe_unused]] const auto read_ = read(fd, &value, sizeof(value));
+        }
+    }
+
+  private:
+    static constexpr int kMaxTimeoutMs = 24 * 60 * 60 * 1000;
+    int fd;
+};
+} // namespace utility
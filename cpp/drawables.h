@@ -1,24 +1,30 @@
 #pragma once
 
 #include "font_size.hpp"
+#include "perfect_key_map.hpp"
+#include "strutils.h"
 
 #include <nlohmann/json.hpp>
 #include <nlohmann/json_fwd.hpp>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <cstddef>
 #include <cstdint>
-#include <exception>
 #include <functional>
 #include <iostream>
 #include <limits>
 #include <map>
+#include <memory>
 #include <optional>
 #include <ostream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <unordered_map>
+#include <vector>
 
 namespace draw_task {
 using json = nlohmann::json;
@@ -42,6 +48,17 @@ struct timestamp_t
         return !isValid();
     }
 
+    /// @returns time point after which it is expired, or nothing if it lives forever.
+    [[nodiscard]]
+    std::optional<std::chrono::steady_clock::time_point> deadline() const
+    {
+        if (ttl < std::chrono::seconds::zero())
+        {
+            return std::nullopt;
+        }
+        return created_at + ttl;
+    }
+
     timestamp_t &operator=(int aSeconds)
     {
         ttl = std::chrono::seconds(aSeconds);
@@ -49,6 +66,53 @@ struct timestamp_t
     }
 };
 
+/// @brief Axis aligned area on the screen.
+struct screen_rect_t
+{
+    int x{0};
+    int y{0};
+    int width{0};
+    int height{0};
+
+    [[nodiscard]]
+    bool isEmpty() const
+    {
+        return width <= 0 || height <= 0;
+    }
+
+    [[nodiscard]]
+    bool intersects(const screen_rect_t &other) const
+    {
+        return !isEmpty() && !other.isEmpty() && x < other.x + other.width
+               && other.x < x + width && y < other.y + other.height && other.y < y + height;
+    }
+
+    /// @returns smallest rectangle which contains both this and @p other.
+    [[nodiscard]]
+    screen_rect_t united(const screen_rect_t &other) const
+    {
+        if (isEmpty())
+        {
+            return other;
+        }
+        if (other.isEmpty())
+        {
+            return *this;
+        }
+        const int left = std::min(x, other.x);
+        const int top = std::min(y, other.y);
+        const int right = std::max(x + width, other.x + other.width);
+        const int bottom = std::max(y + height, other.y + other.height);
+        return {left, top, right - left, bottom - top};
+    }
+
+    bool operator==(const screen_rect_t &other) const
+    {
+        return std::tie(x, y, width, height)
+               == std::tie(other.x, other.y, other.width, other.height);
+    }
+};
+
 enum class drawmode_t : std::uint8_t {
     idk,
     text,
@@ -68,6 +132,33 @@ inline std::ostream &operator<<(std::ostream &os, drawmode_t val)
     return os;
 }
 
+/// @brief Point of the "vector" shape, coordinates are absolute on the screen.
+struct vector_point_t
+{
+    int x{0};
+    int y{0};
+    // 1-based index of the marker in the shape's markers, 0 if point has no marker.
+    std::uint32_t marker{0};
+
+    bool operator==(const vector_point_t &other) const
+    {
+        return std::tie(x, y, marker) == std::tie(other.x, other.y, other.marker);
+    }
+};
+
+/// @brief Optional marker of the "vector" shape's point.
+struct vector_marker_t
+{
+    std::string color;
+    std::string type;
+    std::string text;
+
+    bool operator==(const vector_marker_t &other) const
+    {
+        return std::tie(color, type, text) == std::tie(other.color, other.type, other.text);
+    }
+};
+
 struct drawitem_t
 {
     static constexpr std::uint32_t kDeltaFontDifference = 4;
@@ -76,6 +167,10 @@ struct drawitem_t
     timestamp_t ttl;
     std::string id;
     std::string command;
+    // Version of the content, newer content has bigger one. It is set when item is stored.
+    std::uint64_t generation{0};
+    // Hash of the data compared by isEqualStoredData(), it is set once item is parsed.
+    std::uint64_t contentHash{0};
 
     drawmode_t drawmode{drawmode_t::idk};
     // common
@@ -85,6 +180,9 @@ struct drawitem_t
 
     struct drawtext_t
     {
+        static constexpr int kTabSizeInSpaces = 2;
+        static constexpr float kLineSpacing = 1.05f;
+
         // text
         std::string text;
         std::string size;
@@ -110,22 +208,43 @@ struct drawitem_t
             return fontSize.value_or(
               {size == "large" ? kNormalFontSize + kDeltaFontDifference : kNormalFontSize});
         }
+
+        /// @returns distance between the tops of the consequent lines.
+        [[nodiscard]]
+        int getLineHeight() const
+        {
+            return static_cast<int>(kLineSpacing * static_cast<float>(getFinalFontSize().size));
+        }
+
+        /// @returns text split into the lines as it should be drawn.
+        [[nodiscard]]
+        std::vector<std::string> getLinesToDraw() const
+        {
+            static const std::string nbsp = "\xC2\xA0";
+            return utility::split(
+              utility::replace_tabs_with_spaces(text.empty() ? nbsp : text, kTabSizeInSpaces),
+              '\n');
+        }
     } text;
 
     struct drawshape_t
     {
+        static constexpr int kStrokeWidth = 1;
+
         // shape
         std::string shape;
         std::string fill;
         int w{0};
         int h{0};
         font_size::FontPixelSize vector_font_size{0};
-        json vect;
+        // "vector" shape, points are packed, rare markers are kept aside.
+        std::vector<vector_point_t> points;
+        std::vector<vector_marker_t> markers;
 
         bool operator==(const drawshape_t &other) const
         {
             static const auto tie = [](const drawshape_t &val) {
-                return std::tie(val.shape, val.fill, val.w, val.h, val.vect);
+                return std::tie(val.shape, val.fill, val.w, val.h, val.points, val.markers);
             };
 
             return tie(*this) == tie(other);
@@ -154,14 +273,20 @@ struct drawitem_t
 
             return tie(*this) == tie(other);
         }
-
-        // This field is set by window implementation, and serves caching purposes.
-        mutable std::function<void()> render{nullptr};
     } svg;
 
     // Anti-flickering field,
     bool already_rendered{false};
 
+    // Those fields are set by window implementation, and serve caching purposes.
+    mutable std::function<void()> render{nullptr};
+    // Screen area covered by this item, it is used to repaint only damaged parts of the screen.
+    mutable screen_rect_t bounds{};
+    // Item converted to SVG because it cannot be drawn natively, it is built once.
+    mutable std::shared_ptr<const drawitem_t> svgFallback{nullptr};
+    // Natively prepared item kept while it waits for rasters, type is known to window only.
+    mutable std::shared_ptr<void> pendingNative{nullptr};
+
     [[nodiscard]]
     bool isEqualStoredData(const drawitem_t &other) const
     {
@@ -172,6 +297,51 @@ struct drawitem_t
         return tie(*this) == tie(other);
     }
 
+    /// @returns hash of the fields compared by isEqualStoredData(), so equal items have equal
+    /// hashes.
+    [[nodiscard]]
+    std::uint64_t computeContentHash() const
+    {
+        std::uint64_t seed = 0u;
+        const auto combine = [&seed](std::uint64_t value) {
+            seed ^= value + 0x9e3779b97f4a7c15u + (seed << 6u) + (seed >> 2u); // NOLINT
+        };
+        const auto combineStr = [&combine](std::string_view value) {
+            combine(std::hash<std::string_view>{}(value));
+        };
+
+        combine(static_cast<std::uint64_t>(drawmode));
+        combine(static_cast<std::uint32_t>(x));
+        combine(static_cast<std::uint32_t>(y));
+        combineStr(color);
+
+        combineStr(text.text);
+        combineStr(text.size);
+        combine(text.fontSize ? text.fontSize->size + 1u : 0u);
+
+        combineStr(shape.shape);
+        combineStr(shape.fill);
+        combine(static_cast<std::uint32_t>(shape.w));
+        combine(static_cast<std::uint32_t>(shape.h));
+        for (const auto &point : shape.points)
+        {
+            combine(static_cast<std::uint32_t>(point.x));
+            combine(static_cast<std::uint32_t>(point.y));
+            combine(point.marker);
+        }
+        for (const auto &marker : shape.markers)
+        {
+            combineStr(marker.color);
+            combineStr(marker.type);
+            combineStr(marker.text);
+        }
+
+        combineStr(svg.svg);
+        combineStr(svg.css);
+        combineStr(svg.fontFile);
+        return seed;
+    }
+
     [[nodiscard]]
     bool isExpired() const
     {
@@ -210,191 +380,617 @@ using draw_items_t = std::map<std::string, drawitem_t>;
     command: text string command.
 */
 
-inline draw_items_t parseJsonString(const std::string &src)
+/// @brief Fields of drawitem_t which client can set. Each wire format maps own keys to those.
+enum class item_field_t : std::uint8_t {
+    unknown,
+    x,
+    y,
+    w,
+    h,
+    color,
+    text,
+    svg,
+    css,
+    size,
+    font_size,
+    font_file,
+    vector_font_size,
+    shape,
+    fill,
+    vector,
+    ttl,
+    // Json has several keys of the id, those have precedence of their (sorted) order.
+    id,
+    msgid,
+    shapeid,
+    svgid,
+    command,
+};
+
+/// @brief Fills single drawitem_t field by field and stores finished items, so all wire formats
+/// share the same rules of modes, ids and ttls.
+class drawitem_builder_t
 {
-    // I hate chained IFs, lets do it more readable....
-    const static std::map<std::string, std::function<void(const json &, drawitem_t &)>> processors =
-      {
-        {"x",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.x = node.get<int>();
-         }},
-
-        {"y",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.y = node.get<int>();
-         }},
-
-        {"w",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.drawmode = drawmode_t::shape;
-             drawitem.shape.w = node.get<int>();
-         }},
-
-        {"h",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.drawmode = drawmode_t::shape;
-             drawitem.shape.h = node.get<int>();
-         }},
-
-        {"color",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.color = node.get<std::string>();
-         }},
-
-        {"text",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.drawmode = drawmode_t::text;
-             drawitem.text.text = node.get<std::string>();
-         }},
-        {"svg",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.drawmode = drawmode_t::svg;
-             drawitem.svg.svg = node.get<std::string>();
-         }},
-        {"css",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.drawmode = drawmode_t::svg;
-             drawitem.svg.css = node.get<std::string>();
-         }},
-        {"size",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.drawmode = drawmode_t::text;
-             drawitem.text.size = node.get<std::string>();
-         }},
-
-        {"font_size",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.drawmode = drawmode_t::text;
-             drawitem.text.fontSize = {node.get<std::uint32_t>()};
-         }},
-        {"font_file",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.drawmode = drawmode_t::svg;
-             drawitem.svg.fontFile = node.get<std::string>();
-         }},
-        {"vector_font_size",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.drawmode = drawmode_t::shape;
-             drawitem.shape.vector_font_size = {node.get<std::uint32_t>()};
-         }},
-
-        {"shape",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.drawmode = drawmode_t::shape;
-             drawitem.shape.shape = node.get<std::string>();
-         }},
-
-        {"fill",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.drawmode = drawmode_t::shape;
-             drawitem.shape.fill = node.get<std::string>();
-         }},
-
-        {"vector",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.drawmode = drawmode_t::shape;
-             drawitem.shape.vect = node;
-         }},
-
-        {"ttl",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.ttl = node.get<int>();
-         }},
-
-        {"id",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.id = node.get<std::string>();
-         }},
-
-        {"msgid",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.id = node.get<std::string>();
-         }},
-
-        {"shapeid",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.id = node.get<std::string>();
-         }},
-        {"svgid",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.id = node.get<std::string>();
-         }},
-
-        {"command",
-         [](const json &node, drawitem_t &drawitem) {
-             drawitem.command = node.get<std::string>();
-         }},
-      };
+  public:
+    /// @param src - source of the message, it is printed on errors if not empty.
+    explicit drawitem_builder_t(std::string_view src) :
+        src(src)
+    {
+    }
 
-    draw_items_t result;
-    const auto parseSingleObject = [&result, &src](const auto &aObject) {
-        drawitem_t drawitem;
-        for (const auto &kv : aObject.items())
+    /// @returns true if field value is number, false if it is string or points.
+    static bool isNumeric(item_field_t field)
+    {
+        switch (field)
         {
-            // std::cout << "Key: [" << kv.key() << "]" << std::endl;
+            case item_field_t::x:
+            case item_field_t::y:
+            case item_field_t::w:
+            case item_field_t::h:
+            case item_field_t::font_size:
+            case item_field_t::vector_font_size:
+            case item_field_t::ttl:
+                return true;
+            default:
+                return false;
+        }
+    }
 
-            const auto it = processors.find(kv.key());
-            if (it != processors.end())
-            {
-                const auto prev_mode = drawitem.drawmode;
-                it->second(kv.value(), drawitem);
-                if (prev_mode != drawmode_t::idk && drawitem.drawmode != prev_mode)
+    /// @brief Starts new item, previous one must be finished.
+    void begin()
+    {
+        item = drawitem_t{};
+        broken = false;
+        idField = item_field_t::unknown;
+    }
+
+    /// @returns true if item became invalid, the rest of its fields must be ignored.
+    [[nodiscard]]
+    bool isBroken() const
+    {
+        return broken;
+    }
+
+    void setNumber(item_field_t field, int value)
+    {
+        switch (field)
+        {
+            case item_field_t::x:
+                item.x = value;
+                break;
+            case item_field_t::y:
+                item.y = value;
+                break;
+            case item_field_t::w:
+                setMode(drawmode_t::shape);
+                item.shape.w = value;
+                break;
+            case item_field_t::h:
+                setMode(drawmode_t::shape);
+                item.shape.h = value;
+                break;
+            case item_field_t::font_size:
+                setMode(drawmode_t::text);
+                item.text.fontSize = {static_cast<std::uint32_t>(value)};
+                break;
+            case item_field_t::vector_font_size:
+                setMode(drawmode_t::shape);
+                item.shape.vector_font_size = {static_cast<std::uint32_t>(value)};
+                break;
+            case item_field_t::ttl:
+                item.ttl = value;
+                break;
+            default:
+                break;
+        }
+    }
+
+    void setString(item_field_t field, std::string value)
+    {
+        switch (field)
+        {
+            case item_field_t::color:
+                item.color = std::move(value);
+                break;
+            case item_field_t::text:
+                setMode(drawmode_t::text);
+                item.text.text = std::move(value);
+                break;
+            case item_field_t::svg:
+                setMode(drawmode_t::svg);
+                item.svg.svg = std::move(value);
+                break;
+            case item_field_t::css:
+                setMode(drawmode_t::svg);
+                item.svg.css = std::move(value);
+                break;
+            case item_field_t::size:
+                setMode(drawmode_t::text);
+                item.text.size = std::move(value);
+                break;
+            case item_field_t::font_file:
+                setMode(drawmode_t::svg);
+                item.svg.fontFile = std::move(value);
+                break;
+            case item_field_t::shape:
+                setMode(drawmode_t::shape);
+                item.shape.shape = std::move(value);
+                break;
+            case item_field_t::fill:
+                setMode(drawmode_t::shape);
+                item.shape.fill = std::move(value);
+                break;
+            case item_field_t::id:
+            case item_field_t::msgid:
+            case item_field_t::shapeid:
+            case item_field_t::svgid:
+                // Keys of the json object were visited sorted, so the last of them won.
+                if (field >= idField)
                 {
-                    std::cerr << "Mode was double switched text/shape in the same JSON. "
-                              << "From " << prev_mode << " to " << drawitem.drawmode << ". "
-                              << "Ignoring. Full source json:\n"
-                              << src << std::endl;
-                    drawitem.drawmode = drawmode_t::idk;
-                    break;
+                    idField = field;
+                    item.id = std::move(value);
                 }
+                break;
+            case item_field_t::command:
+                item.command = std::move(value);
+                break;
+            default:
+                break;
+        }
+    }
+
+    /// @brief Starts (empty) list of the points of the "vector" field.
+    void startPoints()
+    {
+        setMode(drawmode_t::shape);
+        item.shape.points.clear();
+        item.shape.markers.clear();
+    }
+
+    /// @brief Appends point to the "vector" field, marker is stored only if it has something set.
+    void addPoint(int x, int y, vector_marker_t &&marker)
+    {
+        auto &shape = item.shape;
+        vector_point_t point{x, y, 0};
+        if (!marker.color.empty() || !marker.type.empty() || !marker.text.empty())
+        {
+            shape.markers.emplace_back(std::move(marker));
+            point.marker = static_cast<std::uint32_t>(shape.markers.size());
+        }
+        shape.points.emplace_back(point);
+    }
+
+    /// @brief Moves item into @p result if it is drawable or command.
+    void finish(draw_items_t &result)
+    {
+        if (item.drawmode == draw_task::drawmode_t::idk && !item.isCommand())
+        {
+            return;
+        }
+        if (item.id.empty())
+        {
+            static const std::string prefix = "AUTOID:";
+            static std::atomic<std::size_t> id{0};
+            item.id = prefix + std::to_string(id++);
+            if (item.ttl.ttl < std::chrono::seconds::zero())
+            {
+                // We do not allow messages without ID stay forever.
+                // Because without ID it cannot be overwritten / cleansed.
+                item.ttl.ttl = std::chrono::seconds(60);
             }
-            else
+        }
+        item.contentHash = item.computeContentHash();
+        auto id = item.id;
+        result[std::move(id)] = std::move(item);
+    }
+
+  private:
+    std::string_view src;
+    drawitem_t item;
+    // Mode was switched twice, the rest of the item is ignored.
+    bool broken{false};
+    // Key which has set the id.
+    item_field_t idField{item_field_t::unknown};
+
+    void setMode(drawmode_t mode)
+    {
+        if (item.drawmode != drawmode_t::idk && item.drawmode != mode)
+        {
+            std::cerr << "Mode was double switched text/shape in the same message. "
+                      << "From " << item.drawmode << " to " << mode << ". Ignoring.";
+            if (!src.empty())
             {
-                std::cout << "bad key: \"" << kv.key() << "\"" << std::endl;
+                std::cerr << " Full source:\n" << src;
             }
+            std::cerr << std::endl;
+            item.drawmode = drawmode_t::idk;
+            broken = true;
+            return;
+        }
+        item.drawmode = mode;
+    }
+};
+
+/// @brief Builds drawitem_t objects directly from SAX events of the json parser, no DOM is built.
+/// @details Accepts single object or array of objects. Keys are dispatched by perfect hash, values
+/// are moved into the item's fields. Value of the wrong type for known key throws, same as
+/// json::get() does.
+class json_items_sax_t
+{
+  public:
+    using number_integer_t = json::number_integer_t;
+    using number_unsigned_t = json::number_unsigned_t;
+    using number_float_t = json::number_float_t;
+    using string_t = json::string_t;
+    using binary_t = json::binary_t;
+
+    explicit json_items_sax_t(std::string_view src) :
+        builder(src)
+    {
+    }
+
+    [[nodiscard]]
+    draw_items_t takeResult()
+    {
+        return std::move(result);
+    }
+
+    bool null()
+    {
+        return scalar({scalar_t::kind_t::null});
+    }
+
+    bool boolean(bool val)
+    {
+        scalar_t value{scalar_t::kind_t::boolean};
+        value.integer = val ? 1 : 0;
+        return scalar(value);
+    }
+
+    bool number_integer(number_integer_t val)
+    {
+        scalar_t value{scalar_t::kind_t::number};
+        value.integer = val;
+        return scalar(value);
+    }
+
+    bool number_unsigned(number_unsigned_t val)
+    {
+        scalar_t value{scalar_t::kind_t::number};
+        value.integer = static_cast<std::int64_t>(val);
+        return scalar(value);
+    }
+
+    bool number_float(number_float_t val, const string_t & /*unused*/)
+    {
+        scalar_t value{scalar_t::kind_t::number};
+        value.integer = static_cast<std::int64_t>(val);
+        return scalar(value);
+    }
+
+    bool string(string_t &val)
+    {
+        scalar_t value{scalar_t::kind_t::string};
+        value.string = &val;
+        return scalar(value);
+    }
+
+    bool binary(binary_t & /*unused*/)
+    {
+        return scalar({scalar_t::kind_t::null});
+    }
+
+    bool start_object(std::size_t /*unused*/)
+    {
+        return open(true);
+    }
+
+    bool start_array(std::size_t /*unused*/)
+    {
+        return open(false);
+    }
+
+    bool end_object()
+    {
+        return close();
+    }
+
+    bool end_array()
+    {
+        return close();
+    }
+
+    bool key(string_t &val)
+    {
+        if (levels.empty())
+        {
+            return true;
         }
-        if (drawitem.drawmode != draw_task::drawmode_t::idk || drawitem.isCommand())
+        if (levels.back() == level_t::item)
         {
-            if (drawitem.id.empty())
+            field = kItemKeys.find(val, item_field_t::unknown);
+            if (field == item_field_t::unknown && !builder.isBroken())
             {
-                static const std::string prefix = "AUTOID:";
-                static std::atomic<std::size_t> id{0};
-                drawitem.id = prefix + std::to_string(id++);
-                if (drawitem.ttl.ttl < std::chrono::seconds::zero())
+                std::cout << "bad key: \"" << val << "\"" << std::endl;
+            }
+        }
+        else if (levels.back() == level_t::point)
+        {
+            pointField = kPointKeys.find(val, point_field_t::unknown);
+        }
+        return true;
+    }
+
+    bool parse_error(std::size_t /*position*/, const std::string & /*last_token*/,
+                     const nlohmann::detail::exception &ex)
+    {
+        throw std::invalid_argument(ex.what());
+    }
+
+  private:
+    enum class point_field_t : std::uint8_t {
+        unknown,
+        x,
+        y,
+        color,
+        marker,
+        text,
+    };
+
+    static constexpr utility::PerfectKeyMap<item_field_t, 64> kItemKeys{{
+      {"x", item_field_t::x},
+      {"y", item_field_t::y},
+      {"w", item_field_t::w},
+      {"h", item_field_t::h},
+      {"color", item_field_t::color},
+      {"text", item_field_t::text},
+      {"svg", item_field_t::svg},
+      {"css", item_field_t::css},
+      {"size", item_field_t::size},
+      {"font_size", item_field_t::font_size},
+      {"font_file", item_field_t::font_file},
+      {"vector_font_size", item_field_t::vector_font_size},
+      {"shape", item_field_t::shape},
+      {"fill", item_field_t::fill},
+      {"vector", item_field_t::vector},
+      {"ttl", item_field_t::ttl},
+      {"id", item_field_t::id},
+      {"msgid", item_field_t::msgid},
+      {"shapeid", item_field_t::shapeid},
+      {"svgid", item_field_t::svgid},
+      {"command", item_field_t::command},
+    }};
+
+    static constexpr utility::PerfectKeyMap<point_field_t, 16> kPointKeys{{
+      {"x", point_field_t::x},
+      {"y", point_field_t::y},
+      {"color", point_field_t::color},
+      {"marker", point_field_t::marker},
+      {"text", point_field_t::text},
+    }};
+
+    /// @brief Container which is parsed now.
+    enum class level_t : std::uint8_t {
+        items,      // top level array of the items
+        item,       // single item object
+        points,     // "vector" array (or object) of the points
+        point,      // single point object
+        skipped,    // anything else, its content is ignored
+    };
+
+    struct scalar_t
+    {
+        enum class kind_t : std::uint8_t {
+            null,
+            boolean,
+            number,
+            string,
+        } kind;
+
+        std::int64_t integer{0};
+        string_t *string{nullptr};
+    };
+
+    draw_items_t result;
+    drawitem_builder_t builder;
+    std::vector<level_t> levels;
+    item_field_t field{item_field_t::unknown};
+
+    std::optional<int> pointX;
+    std::optional<int> pointY;
+    vector_marker_t pointMarker;
+    point_field_t pointField{point_field_t::unknown};
+    // Invalid point met, the rest of the points is ignored, same as drawing did.
+    bool pointsBroken{false};
+
+    bool scalar(const scalar_t &value)
+    {
+        if (levels.empty())
+        {
+            return true;
+        }
+        switch (levels.back())
+        {
+            case level_t::item:
+                if (!builder.isBroken())
                 {
-                    // We do not allow messages without ID stay forever.
-                    // Because without ID it cannot be overwritten / cleansed.
-                    drawitem.ttl.ttl = std::chrono::seconds(60);
+                    applyItemField(value);
                 }
+                break;
+            case level_t::points:
+                // Point must be object.
+                pointsBroken = true;
+                break;
+            case level_t::point:
+                applyPointField(value);
+                break;
+            case level_t::items:
+            case level_t::skipped:
+                break;
+        }
+        return true;
+    }
+
+    void applyItemField(const scalar_t &value)
+    {
+        if (field == item_field_t::unknown)
+        {
+            return;
+        }
+        if (field == item_field_t::vector)
+        {
+            // Not a container, so there are no points.
+            builder.startPoints();
+            return;
+        }
+        if (drawitem_builder_t::isNumeric(field))
+        {
+            if (value.kind != scalar_t::kind_t::number && value.kind != scalar_t::kind_t::boolean)
+            {
+                throw std::invalid_argument("Field must be number.");
             }
+            builder.setNumber(field, static_cast<int>(value.integer));
+            return;
+        }
+        if (value.kind != scalar_t::kind_t::string)
+        {
+            throw std::invalid_argument("Field must be string.");
+        }
+        builder.setString(field, std::move(*value.string));
+    }
 
-            result[drawitem.id] = drawitem;
+    void applyPointField(const scalar_t &value)
+    {
+        // Same as get<int>() of json, booleans are accepted as 0 / 1.
+        const auto isNumber =
+          value.kind == scalar_t::kind_t::number || value.kind == scalar_t::kind_t::boolean;
+        const auto isString = value.kind == scalar_t::kind_t::string;
+        switch (pointField)
+        {
+            case point_field_t::unknown:
+                break;
+            case point_field_t::x:
+                pointsBroken = pointsBroken || !isNumber;
+                pointX = static_cast<int>(value.integer);
+                break;
+            case point_field_t::y:
+                pointsBroken = pointsBroken || !isNumber;
+                pointY = static_cast<int>(value.integer);
+                break;
+            case point_field_t::color:
+            case point_field_t::marker:
+            case point_field_t::text:
+                if (!isString)
+                {
+                    pointsBroken = true;
+                    break;
+                }
+                auto &target = pointField == point_field_t::color    ? pointMarker.color
+                               : pointField == point_field_t::marker ? pointMarker.type
+                                                                     : pointMarker.text;
+                target = std::move(*value.string);
+                break;
         }
-    };
+    }
 
-    if (!src.empty())
+    bool open(bool isObject)
     {
-        const auto jsrc = json::parse(src);
-        if (jsrc.is_array())
+        const auto parent = levels.empty() ? std::optional<level_t>{} : levels.back();
+        auto level = level_t::skipped;
+        if (!parent)
         {
-            for (const auto &arr_elem : jsrc)
+            level = isObject ? level_t::item : level_t::items;
+        }
+        else if (*parent == level_t::items && isObject)
+        {
+            level = level_t::item;
+        }
+        else if (*parent == level_t::item && !builder.isBroken()
+                 && field != item_field_t::unknown)
+        {
+            if (field != item_field_t::vector)
             {
-                parseSingleObject(arr_elem);
+                throw std::invalid_argument("Only \"vector\" field can be object or array.");
             }
+            builder.startPoints();
+            pointsBroken = false;
+            level = level_t::points;
+        }
+        else if (*parent == level_t::points && !pointsBroken)
+        {
+            pointsBroken = !isObject;
+            level = isObject ? level_t::point : level_t::skipped;
+        }
+        else if (*parent == level_t::point && pointField != point_field_t::unknown)
+        {
+            pointsBroken = true;
+        }
+
+        if (level == level_t::item)
+        {
+            builder.begin();
+            field = item_field_t::unknown;
         }
-        else
+        if (level == level_t::point)
         {
-            parseSingleObject(jsrc);
+            pointX.reset();
+            pointY.reset();
+            pointMarker = {};
+            pointField = point_field_t::unknown;
         }
+        levels.push_back(level);
+        return true;
     }
 
-    return result;
+    bool close()
+    {
+        const auto level = levels.back();
+        levels.pop_back();
+        if (level == level_t::item)
+        {
+            builder.finish(result);
+        }
+        if (level == level_t::point)
+        {
+            finishPoint();
+        }
+        return true;
+    }
+
+    void finishPoint()
+    {
+        if (!pointX || !pointY)
+        {
+            pointsBroken = true;
+        }
+        if (pointsBroken)
+        {
+            std::cerr << "Json-point parse failed, the rest of the vector is ignored."
+                      << std::endl;
+            return;
+        }
+        builder.addPoint(*pointX, *pointY, std::move(pointMarker));
+    }
+};
+
+inline draw_items_t parseJsonString(std::string_view src)
+{
+    if (src.empty())
+    {
+        return {};
+    }
+    json_items_sax_t handler(src);
+    json::sax_parse(src, &handler);
+    return handler.takeResult();
 }
 
 /// @brief Represents shape "vector" / marker style in json.
 struct TMarkerInVectorInShape
 {
+    static constexpr int kHalfSize = 4;
+    static constexpr int kTextOffsetX = 1;
+    static constexpr int kTextOffsetY = 0;
+
     int x{-1};
     int y{-1};
 
@@ -426,31 +1022,38 @@ struct TMarkerInVectorInShape
         return !text.empty();
     }
 
-    static TMarkerInVectorInShape FromVectorNode(const json &val)
+    /// @returns text task which draws marker's text next to the marker.
+    [[nodiscard]]
+    drawitem_t MakeTextTask(font_size::FontPixelSize vector_font_size) const
     {
-        static constexpr auto kMarkerKey = "marker";
-        static constexpr auto kMarkerColorKey = "color";
-        static constexpr auto kMarkerTextKey = "text";
+        drawitem_t textTask;
+        textTask.drawmode = drawmode_t::text;
+        textTask.x = x + kHalfSize + kTextOffsetX;
+        textTask.y = y - kTextOffsetY;
+        textTask.color = color;
+        textTask.text.fontSize = vector_font_size;
+        textTask.text.text = text;
+        return textTask;
+    }
 
+    static TMarkerInVectorInShape FromVectorPoint(const drawitem_t::drawshape_t &shape,
+                                                  const vector_point_t &point)
+    {
         TMarkerInVectorInShape marker;
-        const auto getStr = [&](const auto &key) -> std::string {
-            if (val.contains(key))
-            {
-                return val[key].template get<std::string>();
-            }
-            return {};
-        };
-
-        marker.x = val["x"].get<int>();
-        marker.y = val["y"].get<int>();
-        marker.color = getStr(kMarkerColorKey);
-        marker.type = getStr(kMarkerKey);
-        marker.text = getStr(kMarkerTextKey);
+        marker.x = point.x;
+        marker.y = point.y;
+        if (point.marker > 0u && point.marker <= shape.markers.size())
+        {
+            const auto &src = shape.markers[point.marker - 1u];
+            marker.color = src.color;
+            marker.type = src.type;
+            marker.text = src.text;
+        }
         return marker;
     }
 };
 
-/// @brief Parses json's "vect" object and calls related drawers.
+/// @brief Walks points of the "vect" shape and calls related drawers.
 /// @note It uses provided drawer to avoid copy-paste of code for different output devices (like
 /// X11/Wayland).
 /// @returns false if @p src is not a "vector" shape.
@@ -467,32 +1070,17 @@ inline bool ForEachVectorPointsPair(const drawitem_t &src, const taLineDrawer &l
     constexpr static int UNINIT_COORD = std::numeric_limits<int>::max();
     int x1 = UNINIT_COORD, y1 = UNINIT_COORD, x2 = UNINIT_COORD, y2 = UNINIT_COORD;
 
-    for (const auto &node_ : src.shape.vect.items())
+    for (const auto &point : src.shape.points)
     {
-        // node_ is a point
-        const auto &val = node_.value();
-        int x = 0, y = 0;
-        TMarkerInVectorInShape marker;
-        try
-        {
-            x = val["x"].get<int>();
-            y = val["y"].get<int>();
-            marker = TMarkerInVectorInShape::FromVectorNode(val);
-        }
-        catch (std::exception &e)
-        {
-            std::cerr << "Json-point parse failed with message: " << e.what() << std::endl;
-            break;
-        }
-        catch (...)
-        {
-            std::cerr << "Json-point parse failed with uknnown reason." << std::endl;
-            break;
-        }
-
-        if (marker.IsSet())
+        const int x = point.x;
+        const int y = point.y;
+        if (point.marker > 0u)
         {
-            markerDrawer(marker, src.shape.getFinalFontSize());
+            const auto marker = TMarkerInVectorInShape::FromVectorPoint(src.shape, point);
+            if (marker.IsSet())
+            {
+                markerDrawer(marker, src.shape.getFinalFontSize());
+            }
         }
 
         if (x1 == UNINIT_COORD)
@@ -2,17 +2,23 @@
 
 #include "freetype/fttypes.h"
 #include "lambda_visitors.hpp"
+#include "lru_cache.hpp"
 #include "opaque_ptr.h"
 #include "unicode_splitter.hpp"
 
 #include <fontconfig/fontconfig.h>
 #include <freetype/freetype.h>
+#include <freetype/ftcache.h>
+#include <freetype/ftglyph.h>
 #include <freetype/ftimage.h>
 #include <freetype/tttables.h>
 #include <png.h>
 #include <pngconf.h>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
 #include <cassert>
 #include <cmath>
 #include <cstddef>
@@ -20,11 +26,16 @@
 #include <cstdio>
 #include <cstdlib>
 #include <filesystem>
+#include <functional>
 #include <iterator>
 #include <map>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <string>
+#include <tuple>
 #include <type_traits>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
@@ -63,23 +74,9 @@ inline std::string encodeBase64(const std::vector<unsigned char> &data)
     return out;
 }
 
-struct Bitmap
-{
-    Bitmap(unsigned int w, unsigned int h) : // NOLINT
-        width(w),
-        height(h),
-        pixels{}
-    {
-        pixels.resize(static_cast<std::size_t>(width) * static_cast<std::size_t>(height)
-                      * static_cast<std::size_t>(4u));
-    }
+using emoji::RgbaBitmap;
 
-    unsigned int width;
-    unsigned int height;
-    std::vector<unsigned char> pixels{}; // RGBA
-};
-
-Bitmap scaleBitmapToFitHeight(const Bitmap &bmp, unsigned char desiredHeight)
+RgbaBitmap scaleBitmapToFitHeight(const RgbaBitmap &bmp, unsigned char desiredHeight)
 {
     if (bmp.height == 0 || bmp.width == 0 || bmp.pixels.empty())
     {
@@ -90,7 +87,7 @@ Bitmap scaleBitmapToFitHeight(const Bitmap &bmp, unsigned char desiredHeight)
     const auto newWidth = static_cast<unsigned int>(static_cast<float>(bmp.width) * scale);
     const auto newHeight = desiredHeight;
 
-    Bitmap result(newWidth, newHeight);
+    RgbaBitmap result(newWidth, newHeight);
     for (unsigned int y = 0; y < newHeight; ++y)
     {
         const float srcY = static_cast<float>(y) / scale;
@@ -123,7 +120,7 @@ Bitmap scaleBitmapToFitHeight(const Bitmap &bmp, unsigned char desiredHeight)
     return result;
 }
 
-std::vector<unsigned char> encodePngRGBA(const Bitmap &bmp)
+std::vector<unsigned char> encodePngRGBA(const RgbaBitmap &bmp)
 {
     std::vector<unsigned char> pngData;
     png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
@@ -196,6 +193,38 @@ std::string findFontFile(const std::string &familyName)
     return file;
 }
 
+// FYI: Configurable value. Limits of the FreeType cache manager: opened faces, sized faces and
+// bytes of the cached glyph images.
+constexpr FT_UInt kMaxCachedFaces = 8u;
+constexpr FT_UInt kMaxCachedSizes = 16u;
+constexpr FT_ULong kMaxCachedBytes = 4u * 1024u * 1024u;
+
+// FYI: Configurable value. Byte budget of the rendered PNGs cache, bitmaps use kBitmapCacheBudget.
+constexpr std::size_t kPngCacheBudget = 16u * 1024u * 1024u;
+
+/// @brief Selects fixed size of the bitmap (color) font closest to the @p pixelSize.
+/// @returns pixel size of the selected strike or nothing if there is no fixed size.
+std::optional<FT_UInt> selectBestFixedSize(FT_Face face, std::uint32_t pixelSize)
+{
+    if (face->num_fixed_sizes == 0)
+    {
+        return std::nullopt;
+    }
+    int best_match = 0;
+    int diff = std::abs(static_cast<int>(pixelSize) - face->available_sizes[0].height);
+    for (int i = 1; i < face->num_fixed_sizes; ++i)
+    {
+        const int ndiff = std::abs(static_cast<int>(pixelSize) - face->available_sizes[i].height);
+        if (ndiff < diff)
+        {
+            best_match = i;
+            diff = ndiff;
+        }
+    }
+    // Size request matches strike by rounded ppem, which is 26.6 fixed point.
+    return static_cast<FT_UInt>((face->available_sizes[best_match].y_ppem + 32) >> 6);
+}
+
 std::string toKey(const FontPathOrFamily &key)
 {
     static const LambdaVisitor visitor{
@@ -212,13 +241,75 @@ std::string toKey(const FontPathOrFamily &key)
 } // namespace
 
 namespace emoji {
+/// @brief FreeType faces, sizes and glyph images managed by FTC. Sizes are kept per face and
+/// pixel size, so switching between text sizes does not rescale the face each time. Only
+/// @ref kMaxCachedFaces faces are kept open, those are reopened on demand.
+/// @note FreeType objects are shared by all faces (FTC manager), so any call which touches them
+/// must hold lockFreeType(). Lock cannot be per face: FTC closes least used face or size on lookup
+/// of any other, so face used by one thread could be freed by lookup of another.
+/// Face sources are immutable once created and can be read without it.
 class EmojiRenderer::FtLibrary
 {
+  public:
+    /// @brief Codepoints which have glyphs in the face, built once from its charmap.
+    class Coverage
+    {
+      public:
+        Coverage() = default;
+        explicit Coverage(FT_Face face)
+        {
+            FT_UInt glyphIndex = 0;
+            for (FT_ULong ch = FT_Get_First_Char(face, &glyphIndex); glyphIndex != 0;
+                 ch = FT_Get_Next_Char(face, ch, &glyphIndex))
+            {
+                pages[static_cast<std::uint32_t>(ch >> kPageBits)].set(ch & kPageMask);
+            }
+        }
+
+        [[nodiscard]]
+        bool has(char32_t ch) const
+        {
+            const auto it = pages.find(static_cast<std::uint32_t>(ch >> kPageBits));
+            return it != pages.end() && it->second.test(ch & kPageMask);
+        }
+
+      private:
+        static constexpr unsigned int kPageBits = 8u;
+        static constexpr unsigned int kPageMask = (1u << kPageBits) - 1u;
+        std::unordered_map<std::uint32_t, std::bitset<1u << kPageBits>> pages;
+    };
+
+    /// @brief Font file known to the library, its address is FTC face id. Properties are kept
+    /// here, because FTC can close and reopen the face, so FT_Face pointer is not stable.
+    struct FaceSource
+    {
+        std::string file;
+        // Face could not be opened when source was created.
+        bool failed{false};
+        bool isColor{false};
+        Coverage coverage;
+    };
+
+    /// @brief Symbols [begin; end) of the text which are drawn by the same face.
+    struct CoverageRun
+    {
+        // Index in the fonts list or npos if no font has those symbols.
+        std::size_t fontIndex;
+        FaceSource *source;
+        std::size_t begin;
+        std::size_t end;
+    };
+
   private:
-    using FT_Face_Type = std::remove_pointer_t<FT_Face>;
     using FT_Library_Type = std::remove_pointer_t<FT_Library>;
+    using FTC_Manager_Type = std::remove_pointer_t<FTC_Manager>;
     opaque_ptr<FT_Library_Type> libraryHandle = loadLibrary();
-    std::map<std::string, opaque_ptr<FT_Face_Type>> faces;
+    // Must be destroyed before library.
+    opaque_ptr<FTC_Manager_Type> manager = createManager(libraryHandle);
+    FTC_ImageCache imageCache = createImageCache(manager);
+    std::mutex freeTypeMutex;
+    std::shared_mutex sourcesMutex;
+    std::map<std::string, std::unique_ptr<FaceSource>> sources;
 
     [[nodiscard]]
     static opaque_ptr<FT_Library_Type> loadLibrary()
@@ -234,13 +325,76 @@ class EmojiRenderer::FtLibrary
     }
 
     [[nodiscard]]
-    opaque_ptr<FT_Face_Type> loadFace(const FontPathOrFamily &pathOrName) const
+    static opaque_ptr<FTC_Manager_Type> createManager(FT_Library library)
     {
-        return AllocateOpaque<FT_Face_Type>(FT_Done_Face, [&pathOrName, this]() -> FT_Face {
-            if (!libraryHandle)
+        return AllocateOpaque<FTC_Manager_Type>(&FTC_Manager_Done, [library]() -> FTC_Manager {
+            FTC_Manager mgr{nullptr};
+            if (library
+                && 0
+                     == FTC_Manager_New(library, kMaxCachedFaces, kMaxCachedSizes, kMaxCachedBytes,
+                                        &requestFace, nullptr, &mgr))
             {
-                return nullptr;
+                return mgr;
+            }
+            return nullptr;
+        });
+    }
+
+    [[nodiscard]]
+    static FTC_ImageCache createImageCache(FTC_Manager mgr)
+    {
+        FTC_ImageCache cache{nullptr};
+        if (mgr && FTC_ImageCache_New(mgr, &cache) != 0)
+        {
+            return nullptr;
+        }
+        return cache;
+    }
+
+    static FT_Error requestFace(FTC_FaceID faceId, FT_Library library, FT_Pointer,
+                                FT_Face *face)
+    {
+        const auto *source = static_cast<const FaceSource *>(faceId);
+        return FT_New_Face(library, source->file.c_str(), 0, face);
+    }
+
+    static FTC_ScalerRec makeScaler(FaceSource *source, FT_UInt pixelSize)
+    {
+        FTC_ScalerRec scaler{};
+        scaler.face_id = source;
+        scaler.width = 0;
+        scaler.height = pixelSize;
+        scaler.pixel = 1;
+        return scaler;
+    }
+
+  public:
+    /// @returns lock which must be held while FreeType is used.
+    [[nodiscard]]
+    std::unique_lock<std::mutex> lockFreeType()
+    {
+        return std::unique_lock<std::mutex>(freeTypeMutex);
+    }
+
+    /// @returns source of the font, file of the family is searched and the face is inspected once.
+    /// @note Must not be called while lockFreeType() is held.
+    [[nodiscard]]
+    FaceSource *getSource(const FontPathOrFamily &pathOrName)
+    {
+        const auto key = toKey(pathOrName);
+        {
+            const std::shared_lock lock(sourcesMutex);
+            const auto it = sources.find(key);
+            if (it != sources.end())
+            {
+                return it->second.get();
             }
+        }
+
+        const std::lock_guard lock(sourcesMutex);
+        auto &source = sources[key];
+        if (!source)
+        {
             static const LambdaVisitor findFilePathVisitor = {
               [](const std::filesystem::path &pth) {
                   return pth.string();
@@ -249,109 +403,523 @@ class EmojiRenderer::FtLibrary
                   return findFontFile(fam);
               },
             };
-            const auto file = std::visit(findFilePathVisitor, pathOrName);
+            source = std::make_unique<FaceSource>();
+            source->file = std::visit(findFilePathVisitor, pathOrName);
 
-            FT_Face face{nullptr};
-            if (FT_New_Face(libraryHandle, file.c_str(), 0, &face) == 0)
+            const auto ftLock = lockFreeType();
+            FT_Face face = getFace(source.get());
+            if (face)
             {
-                return face;
+                static const std::uint32_t tag = FT_MAKE_TAG('C', 'B', 'D', 'T');
+                FT_ULong length = 0;
+                FT_Load_Sfnt_Table(face, tag, 0, nullptr, &length);
+                source->isColor = length != 0;
+                source->coverage = Coverage(face);
             }
+            else
+            {
+                // Do not retry to open broken file.
+                source->failed = true;
+            }
+        }
+        return source.get();
+    }
+
+    /// @returns face of the @p source or nullptr. It is valid until next call to this object.
+    /// @note Requires lockFreeType().
+    [[nodiscard]]
+    FT_Face getFace(FaceSource *source)
+    {
+        if (!isValid() || source->failed)
+        {
             return nullptr;
-        });
+        }
+        FT_Face face{nullptr};
+        if (FTC_Manager_LookupFace(manager, source, &face) != 0)
+        {
+            return nullptr;
+        }
+        return face;
     }
 
-  public:
+    /// @brief Activates cached size of the face, color fonts get the closest fixed size.
+    /// @returns face scaled to @p pixelSize or nullptr. It is valid until next call to this object.
+    /// @note Requires lockFreeType().
     [[nodiscard]]
-    opaque_ptr<FT_Face_Type> getFace(const FontPathOrFamily &pathOrName)
+    FT_Face getSizedFace(FaceSource *source, std::uint32_t pixelSize)
     {
-        const auto key = toKey(pathOrName);
-        auto it = faces.find(key);
-        if (it != faces.end())
+        FT_Face face = getFace(source);
+        if (!face)
         {
-            return it->second;
+            return nullptr;
         }
-        auto ptr = loadFace(pathOrName);
-        if (ptr)
+        FT_UInt size = pixelSize;
+        if (source->isColor)
         {
-            faces[key] = ptr;
+            const auto fixed = selectBestFixedSize(face, pixelSize);
+            if (!fixed)
+            {
+                return nullptr;
+            }
+            size = *fixed;
         }
-        return ptr;
+        auto scaler = makeScaler(source, size);
+        FT_Size sized{nullptr};
+        if (FTC_Manager_LookupSize(manager, &scaler, &sized) != 0)
+        {
+            return nullptr;
+        }
+        return sized->face;
+    }
+
+    /// @returns glyph image owned by the cache, it is valid until next call to this object.
+    /// @note Requires lockFreeType().
+    [[nodiscard]]
+    FT_Glyph getGlyphImage(FaceSource *source, std::uint32_t pixelSize, FT_UInt glyphIndex,
+                           FT_Int32 loadFlags)
+    {
+        if (!imageCache || source->failed)
+        {
+            return nullptr;
+        }
+        auto scaler = makeScaler(source, pixelSize);
+        FT_Glyph glyph{nullptr};
+        if (FTC_ImageCache_LookupScaler(imageCache, &scaler, static_cast<FT_ULong>(loadFlags),
+                                        glyphIndex, &glyph, nullptr)
+            != 0)
+        {
+            return nullptr;
+        }
+        return glyph;
     }
 
     [[nodiscard]]
     bool isValid() const
     {
-        return libraryHandle;
+        return libraryHandle && manager;
+    }
+
+    /// @brief Splits @p text into runs, each symbol goes to the first of @p fonts which has it.
+    /// @param allowColorFonts if false, color (emoji) fonts are skipped.
+    /// @note Must not be called while lockFreeType() is held.
+    [[nodiscard]]
+    std::vector<CoverageRun> splitByCoverage(const std::vector<FontPathOrFamily> &fonts,
+                                             const std::vector<char32_t> &text,
+                                             bool allowColorFonts)
+    {
+        std::vector<FaceSource *> usable;
+        usable.reserve(fonts.size());
+        for (const auto &font : fonts)
+        {
+            auto *source = getSource(font);
+            const bool isUsable = !source->failed && (allowColorFonts || !source->isColor);
+            usable.emplace_back(isUsable ? source : nullptr);
+        }
+
+        std::vector<CoverageRun> runs;
+        for (std::size_t i = 0; i < text.size(); ++i)
+        {
+            std::size_t fontIndex = 0;
+            while (fontIndex < usable.size()
+                   && (!usable[fontIndex] || !usable[fontIndex]->coverage.has(text[i])))
+            {
+                ++fontIndex;
+            }
+            if (fontIndex == usable.size())
+            {
+                fontIndex = std::string::npos;
+            }
+
+            if (!runs.empty() && runs.back().fontIndex == fontIndex)
+            {
+                runs.back().end = i + 1;
+                continue;
+            }
+            auto *source = fontIndex != std::string::npos ? usable[fontIndex] : nullptr;
+            runs.push_back({fontIndex, source, i, i + 1});
+        }
+        return runs;
+    }
+};
+
+/// @brief Glyph indexes, advances and kerning of the faces, so repeated text is positioned
+/// without FreeType calls. Cached text is positioned under shared lock by many threads at once.
+class EmojiRenderer::GlyphMetricsCache
+{
+  public:
+    /// @brief Positions glyphs of the @p text drawn by the @p source font, applying kerning.
+    /// @param glyphs receives each glyph and its pen position, can be nullptr.
+    /// @param penX total width of the text.
+    /// @returns false if the font cannot draw the whole text.
+    /// @note Must not be called while FtLibrary::lockFreeType() is held.
+    bool position(FtLibrary &library, FtLibrary::FaceSource *source, const FontPathOrFamily &font,
+                  std::uint32_t pixelSize, FT_Int32 loadFlags, const std::vector<char32_t> &text,
+                  std::vector<PositionedGlyph> *glyphs, FT_Pos &penX)
+    {
+        const auto key = std::make_tuple(toKey(font), pixelSize, loadFlags);
+        {
+            const std::shared_lock lock(mutex);
+            const auto it = faces.find(key);
+            if (it != faces.end())
+            {
+                if (const auto positioned =
+                      positionGlyphs(nullptr, it->second, nullptr, text, glyphs, penX))
+                {
+                    return *positioned;
+                }
+            }
+        }
+
+        const auto ftLock = library.lockFreeType();
+        const std::lock_guard lock(mutex);
+        FT_Face face = library.getFace(source);
+        if (!face)
+        {
+            return false;
+        }
+        auto &cached = faces[key];
+        cached.loadFlags = loadFlags;
+        const auto applySize = [&library, source, pixelSize]() {
+            return library.getSizedFace(source, pixelSize) != nullptr;
+        };
+        return positionGlyphs(face, cached, applySize, text, glyphs, penX).value_or(false);
+    }
+
+    [[nodiscard]]
+    MetricsCacheStats stats() const
+    {
+        return {hits.load(), misses.load()};
+    }
+
+  private:
+    /// @brief Metrics of the single face of the single pixel size loaded by the same flags.
+    struct SizedFace
+    {
+        FT_Int32 loadFlags{FT_LOAD_DEFAULT};
+        std::unordered_map<char32_t, FT_UInt> glyphIndexes;
+        // Nothing if glyph could not be loaded.
+        std::unordered_map<FT_UInt, std::optional<FT_Pos>> advances;
+        // Key is (previous glyph << 32 | next glyph).
+        std::unordered_map<std::uint64_t, FT_Pos> kernings;
+    };
+
+    using SizedFaceKey = std::tuple<std::string, std::uint32_t, FT_Int32>;
+    std::shared_mutex mutex;
+    std::map<SizedFaceKey, SizedFace> faces;
+    std::atomic<std::size_t> hits{0u};
+    std::atomic<std::size_t> misses{0u};
+
+    /// @brief Positions glyphs of the @p text one by one. FreeType is called only for metrics
+    /// missing in @p cached, @p applySize is called once before the first such call.
+    /// @param face nullptr to use @p cached only, it is not modified then.
+    /// @returns nothing if @p face is nullptr and some metrics are missing, otherwise false if
+    /// @p face cannot draw the whole text.
+    std::optional<bool> positionGlyphs(FT_Face face, SizedFace &cached,
+                                       const std::function<bool()> &applySize,
+                                       const std::vector<char32_t> &text,
+                                       std::vector<PositionedGlyph> *glyphs, FT_Pos &penX)
+    {
+        bool sizeApplied = false;
+        bool sizeValid = false;
+        const auto ensureSize = [&]() {
+            if (!sizeApplied)
+            {
+                sizeApplied = true;
+                sizeValid = applySize();
+            }
+            return sizeValid;
+        };
+        // Counted once positioning is finished, so cached only attempt does not count twice.
+        MetricsCacheStats counted;
+        const auto finish = [this, &counted](bool result) {
+            hits += counted.hits;
+            misses += counted.misses;
+            return result;
+        };
+
+        if (glyphs)
+        {
+            glyphs->clear();
+        }
+        penX = 0;
+        FT_UInt prev = 0;
+        for (const char32_t ch : text)
+        {
+            auto indexIt = cached.glyphIndexes.find(ch);
+            if (indexIt == cached.glyphIndexes.end())
+            {
+                if (!face)
+                {
+                    return std::nullopt;
+                }
+                indexIt = cached.glyphIndexes.emplace(ch, FT_Get_Char_Index(face, ch)).first;
+            }
+            const FT_UInt glyphIndex = indexIt->second;
+            if (glyphIndex == 0)
+            {
+                return finish(false);
+            }
+
+            if (prev != 0)
+            {
+                const auto pair = (static_cast<std::uint64_t>(prev) << 32u) | glyphIndex;
+                auto kernIt = cached.kernings.find(pair);
+                if (kernIt == cached.kernings.end())
+                {
+                    if (!face)
+                    {
+                        return std::nullopt;
+                    }
+                    ++counted.misses;
+                    if (!ensureSize())
+                    {
+                        return finish(false);
+                    }
+                    FT_Vector kern{0, 0};
+                    FT_Pos value = 0;
+                    if (FT_Get_Kerning(face, prev, glyphIndex, FT_KERNING_DEFAULT, &kern) == 0)
+                    {
+                        value = kern.x >> 6;
+                    }
+                    kernIt = cached.kernings.emplace(pair, value).first;
+                }
+                else
+                {
+                    ++counted.hits;
+                }
+                penX += kernIt->second;
+            }
+
+            auto advanceIt = cached.advances.find(glyphIndex);
+            if (advanceIt == cached.advances.end())
+            {
+                if (!face)
+                {
+                    return std::nullopt;
+                }
+                ++counted.misses;
+                if (!ensureSize())
+                {
+                    return finish(false);
+                }
+                std::optional<FT_Pos> advance;
+                if (FT_Load_Glyph(face, glyphIndex, cached.loadFlags) == 0)
+                {
+                    advance = face->glyph->advance.x >> 6;
+                }
+                advanceIt = cached.advances.emplace(glyphIndex, advance).first;
+            }
+            else
+            {
+                ++counted.hits;
+            }
+            if (!advanceIt->second)
+            {
+                return finish(false);
+            }
+
+            if (glyphs)
+            {
+                glyphs->push_back({glyphIndex, static_cast<int>(penX)});
+            }
+            penX += *advanceIt->second;
+            prev = glyphIndex;
+        }
+        return finish(true);
+    }
+};
+
+/// @brief Rendered emojis bounded by bytes. Cache is sharded by key hash, so threads looking up
+/// different emojis rarely wait for each other.
+/// @note Sharding helps cache hits only, misses are rendered under single FreeType lock.
+template <typename T>
+class EmojiRenderer::RenderCache
+{
+  public:
+    using TValuePtr = std::shared_ptr<const T>;
+
+    explicit RenderCache(std::size_t budgetBytes) :
+        shards(makeShards(budgetBytes / kShardsCount))
+    {
+    }
+
+    /// @returns cached value or nullptr.
+    TValuePtr find(const EmojiToRender &key)
+    {
+        auto &shard = shardOf(key);
+        const std::lock_guard lock(shard.mutex);
+        if (const auto *found = shard.items.find(key))
+        {
+            ++hits;
+            return *found;
+        }
+        ++misses;
+        return nullptr;
+    }
+
+    /// @brief Keeps value inserted first if other thread rendered the same @p key meanwhile.
+    TValuePtr insert(const EmojiToRender &key, T value)
+    {
+        auto &shard = shardOf(key);
+        const std::lock_guard lock(shard.mutex);
+        if (const auto *found = shard.items.find(key))
+        {
+            return *found;
+        }
+        return shard.items.insert(key, std::make_shared<const T>(std::move(value)));
     }
 
     [[nodiscard]]
-    bool isColorEmojiFont(const opaque_ptr<FT_Face_Type> &face) const
+    RenderCacheStats stats() const
+    {
+        RenderCacheStats result;
+        result.hits = hits.load();
+        result.misses = misses.load();
+        for (const auto &shard : shards)
+        {
+            const std::lock_guard lock(shard->mutex);
+            result.entries += shard->items.size();
+            result.bytes += shard->items.cost();
+            result.evictions += shard->items.evictions();
+        }
+        return result;
+    }
+
+  private:
+    // FYI: Configurable value.
+    static constexpr std::size_t kShardsCount = 16u;
+
+    struct TValueBytes
+    {
+        std::size_t operator()(const TValuePtr &value) const
+        {
+            return sizeof(T) + bytesOf(*value);
+        }
+
+        static std::size_t bytesOf(const PngData &png)
+        {
+            return png.png_base64.size();
+        }
+
+        static std::size_t bytesOf(const RgbaBitmap &bitmap)
+        {
+            return bitmap.pixels.size();
+        }
+    };
+
+    struct Shard
+    {
+        explicit Shard(std::size_t budgetBytes) :
+            items(budgetBytes)
+        {
+        }
+
+        mutable std::mutex mutex;
+        utility::LruCache<EmojiToRender, TValuePtr, EmojiToRenderHash, TValueBytes> items;
+    };
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<std::size_t> hits{0u};
+    std::atomic<std::size_t> misses{0u};
+
+    static std::vector<std::unique_ptr<Shard>> makeShards(std::size_t budgetBytes)
     {
-        static const std::uint32_t tag = FT_MAKE_TAG('C', 'B', 'D', 'T');
-        FT_ULong length = 0;
-        FT_Load_Sfnt_Table(face, tag, 0, nullptr, &length);
-        return length != 0;
+        std::vector<std::unique_ptr<Shard>> result;
+        for (std::size_t i = 0; i < kShardsCount; ++i)
+        {
+            result.emplace_back(std::make_unique<Shard>(budgetBytes));
+        }
+        return result;
+    }
+
+    Shard &shardOf(const EmojiToRender &key)
+    {
+        return *shards[EmojiToRenderHash{}(key) % kShardsCount];
     }
 };
 
+std::size_t EmojiToRenderHash::operator()(const EmojiToRender &what) const
+{
+    static const LambdaVisitor hashFont{
+      [](const std::filesystem::path &p) {
+          return std::filesystem::hash_value(p);
+      },
+      [](const std::string &s) {
+          return std::hash<std::string>{}(s);
+      },
+    };
+    std::size_t seed = std::hash<char32_t>{}(what.emoji);
+    const auto combine = [&seed](std::size_t value) {
+        seed ^= value + 0x9e3779b9u + (seed << 6u) + (seed >> 2u); // NOLINT
+    };
+    combine(what.color);
+    combine(what.font.fontSize.size);
+    for (const auto &font : what.font.fontFaceOrPath)
+    {
+        combine(std::visit(hashFont, font));
+    }
+    return seed;
+}
+
 EmojiRenderer::EmojiRenderer() :
-    library(new EmojiRenderer::FtLibrary())
+    library(new EmojiRenderer::FtLibrary()),
+    metrics(new EmojiRenderer::GlyphMetricsCache()),
+    emojies(new EmojiRenderer::RenderCache<PngData>(kPngCacheBudget)),
+    bitmaps(new EmojiRenderer::RenderCache<RgbaBitmap>(kBitmapCacheBudget))
 {
 }
 
-const PngData &EmojiRenderer::renderToPng(const EmojiToRender &what)
+std::shared_ptr<const PngData> EmojiRenderer::renderToPng(const EmojiToRender &what)
+{
+    static const auto kNoResult = std::make_shared<const PngData>();
+    if (auto existing = emojies->find(what))
+    {
+        return existing;
+    }
+
+    const auto bmp = renderToBitmap(what);
+    if (!bmp->isValid())
+    {
+        return kNoResult;
+    }
+
+    PngData result;
+    result.width = bmp->width;
+    result.height = bmp->height;
+    result.png_base64 = encodeBase64(encodePngRGBA(*bmp));
+    return emojies->insert(what, std::move(result));
+}
+
+std::shared_ptr<const RgbaBitmap> EmojiRenderer::renderToBitmap(const EmojiToRender &what)
 {
-    static const PngData kNoResult;
+    static const auto kNoResult = std::make_shared<const RgbaBitmap>();
     if (what.emoji == 0 || !library || !library->isValid())
     {
         return kNoResult;
     }
 
-    const auto existing_it = emojies.find(what);
-    if (existing_it != emojies.end())
+    if (auto existing = bitmaps->find(what))
     {
-        return existing_it->second;
+        return existing;
     }
 
     for (const auto &font_path : what.font.fontFaceOrPath)
     {
-        auto face = library->getFace(font_path);
-        if (!face)
+        auto *source = library->getSource(font_path);
+        if (source->failed || !source->coverage.has(what.emoji))
         {
             continue;
         }
-        FT_Set_Transform(face, nullptr, nullptr);
 
         FT_Int32 options = FT_LOAD_RENDER;
-
-        if (library->isColorEmojiFont(face))
+        if (source->isColor)
         {
             options |= FT_LOAD_COLOR;
-            if (face->num_fixed_sizes == 0)
-            {
-                continue;
-            }
-            int best_match = 0;
-            int diff =
-              std::abs(static_cast<int>(what.font.fontSize.size) - face->available_sizes[0].height);
-            for (int i = 1; i < face->num_fixed_sizes; ++i)
-            {
-                const int ndiff = std::abs(static_cast<int>(what.font.fontSize.size)
-                                           - face->available_sizes[i].height);
-                if (ndiff < diff)
-                {
-                    best_match = i;
-                    diff = ndiff;
-                }
-            }
-            if (FT_Select_Size(face, best_match))
-            {
-                continue;
-            }
         }
-        else
+        auto ftLock = library->lockFreeType();
+        FT_Face face = library->getSizedFace(source, what.font.fontSize.size);
+        if (!face)
         {
-            FT_Set_Pixel_Sizes(face, 0, what.font.fontSize.size);
+            continue;
         }
 
         const auto glyph_index = FT_Get_Char_Index(face, what.emoji);
@@ -380,9 +948,7 @@ const PngData &EmojiRenderer::renderToPng(const EmojiToRender &what)
             continue;
         }
 
-        auto &result = emojies[what];
-
-        Bitmap bmp(w, h);
+        RgbaBitmap bmp(w, h);
         const auto pixel_mode = glyph->bitmap.pixel_mode;
         const auto pitch = glyph->bitmap.pitch;
         switch (pixel_mode)
@@ -420,109 +986,165 @@ const PngData &EmojiRenderer::renderToPng(const EmojiToRender &what)
                 continue;
         }
 
-        bmp = scaleBitmapToFitHeight(bmp, what.font.fontSize.size);
-
-        result.width = bmp.width;
-        result.height = bmp.height;
-        result.png_base64 = encodeBase64(encodePngRGBA(bmp));
-        return result;
+        ftLock.unlock();
+        return bitmaps->insert(what, scaleBitmapToFitHeight(bmp, what.font.fontSize.size));
     }
     return kNoResult;
 }
 
 EmojiRenderer::~EmojiRenderer() = default;
 
-EmojiRenderer::TextFontWidth EmojiRenderer::computeWidth(const EmojiFontRequirement &font,
-                                                         const std::vector<char32_t> &text)
+std::vector<EmojiRenderer::TextFontWidth>
+EmojiRenderer::computeWidth(const EmojiFontRequirement &font, const std::vector<char32_t> &text)
 {
-    for (const auto &font_path : font.fontFaceOrPath)
+    [[maybe_unused]] const auto isCustomRender = [](char32_t ch) {
+        return SpanRange::needsCustomRender(UnicodeSymbolsIterator::classify(ch));
+    };
+    assert(std::none_of(text.begin(), text.end(), isCustomRender)
+           && "Glyphs for custom rendering should not come here.");
+
+    std::vector<TextFontWidth> result;
+    // Work around if we could not find valid font.
+    const auto addFallback = [&result, &font](std::size_t begin, std::size_t end) {
+        result.push_back({static_cast<unsigned int>(end - begin) * font.fontSize.size,
+                          std::string{}, begin, end});
+    };
+    if (!library || !library->isValid())
     {
-        const auto &face = library->getFace(font_path);
-        if (!face)
+        if (!text.empty())
+        {
+            addFallback(0u, text.size());
+        }
+        return result;
+    }
+
+    for (const auto &run : library->splitByCoverage(font.fontFaceOrPath, text, true))
+    {
+        if (!run.source)
         {
+            addFallback(run.begin, run.end);
             continue;
         }
-        FT_Set_Transform(face, nullptr, nullptr);
-        FT_Int32 options = FT_LOAD_NO_BITMAP;
 
-        if (library->isColorEmojiFont(face))
+        const auto &font_path = font.fontFaceOrPath[run.fontIndex];
+        const FT_Int32 options =
+          run.source->isColor ? FT_LOAD_NO_BITMAP | FT_LOAD_COLOR : FT_LOAD_NO_BITMAP;
+        const std::vector<char32_t> symbols(std::next(text.begin(), run.begin),
+                                            std::next(text.begin(), run.end));
+        FT_Pos pen_x = 0;
+        if (metrics->position(*library, run.source, font_path, font.fontSize.size, options,
+                              symbols, nullptr, pen_x))
         {
-            options |= FT_LOAD_COLOR;
-            if (face->num_fixed_sizes == 0)
-            {
-                continue;
-            }
-            int best_match = 0;
-            int diff =
-              std::abs(static_cast<int>(font.fontSize.size) - face->available_sizes[0].height);
-            for (int i = 1; i < face->num_fixed_sizes; ++i)
-            {
-                const int ndiff =
-                  std::abs(static_cast<int>(font.fontSize.size) - face->available_sizes[i].height);
-                if (ndiff < diff)
-                {
-                    best_match = i;
-                    diff = ndiff;
-                }
-            }
-            if (FT_Select_Size(face, best_match))
-            {
-                continue;
-            }
+            result.push_back({static_cast<unsigned int>(pen_x), font_path, run.begin, run.end});
         }
         else
         {
-            FT_Set_Pixel_Sizes(face, 0, font.fontSize.size);
+            addFallback(run.begin, run.end);
         }
+    }
+    return result;
+}
 
-        FT_Pos pen_x = 0;
-        FT_UInt prev = 0;
+TextLineLayout EmojiRenderer::layoutLine(const EmojiFontRequirement &font,
+                                         const std::vector<char32_t> &text)
+{
+    if (text.empty() || !library || !library->isValid())
+    {
+        return {};
+    }
 
-        bool all_ok = true;
-        for (const char32_t ch : text)
+    TextLineLayout layout;
+    for (const auto &run : library->splitByCoverage(font.fontFaceOrPath, text, false))
+    {
+        if (!run.source)
         {
-            assert(!SpanRange::needsCustomRender(UnicodeSymbolsIterator::classify(ch))
-                   && "Glyphs for custom rendering should not come here.");
-            const FT_UInt glyph_index = FT_Get_Char_Index(face, ch);
-            if (glyph_index == 0)
-            {
-                all_ok = false;
-                break;
-            }
-
-            if (FT_Load_Glyph(face, glyph_index, options) == 0)
-            {
-                pen_x += face->glyph->advance.x >> 6;
-                if (prev)
-                {
-                    FT_Vector kern;
-                    if (FT_Get_Kerning(face, prev, glyph_index, FT_KERNING_DEFAULT, &kern) == 0)
-                    {
-                        pen_x += kern.x >> 6;
-                    }
-                }
-            }
-            else
-            {
-                all_ok = false;
-                break;
-            }
+            return {};
+        }
 
-            prev = glyph_index;
+        FontRun fontRun{font.fontFaceOrPath[run.fontIndex], {}, static_cast<int>(layout.width), 0u};
+        fontRun.glyphs.reserve(run.end - run.begin);
+        const std::vector<char32_t> symbols(std::next(text.begin(), run.begin),
+                                            std::next(text.begin(), run.end));
+        FT_Pos pen_x = 0;
+        if (!metrics->position(*library, run.source, fontRun.font, font.fontSize.size,
+                               FT_LOAD_DEFAULT, symbols, &fontRun.glyphs, pen_x))
+        {
+            return {};
         }
-        if (all_ok)
+        fontRun.width = static_cast<unsigned int>(pen_x);
+        layout.width += fontRun.width;
+        layout.runs.emplace_back(std::move(fontRun));
+    }
+    return layout;
+}
+
+GlyphImage EmojiRenderer::renderGlyph(const FontPathOrFamily &font,
+                                      font_size::FontPixelSize fontSize, unsigned int glyphIndex)
+{
+    GlyphImage result;
+    if (!library || !library->isValid())
+    {
+        return result;
+    }
+    auto *source = library->getSource(font);
+    const FT_Int32 loadFlags = FT_LOAD_RENDER | FT_LOAD_TARGET_NORMAL;
+    const auto ftLock = library->lockFreeType();
+    const FT_Glyph image = library->getGlyphImage(source, fontSize.size, glyphIndex, loadFlags);
+    if (!image || image->format != FT_GLYPH_FORMAT_BITMAP)
+    {
+        return result;
+    }
+
+    const auto glyph = reinterpret_cast<FT_BitmapGlyph>(image); // NOLINT
+    const auto &bitmap = glyph->bitmap;
+    result.left = glyph->left;
+    result.top = glyph->top;
+    // Advance of FT_Glyph is 16.16 fixed point.
+    result.advanceX = static_cast<int>(image->advance.x >> 16);
+    result.width = bitmap.width;
+    result.height = bitmap.rows;
+    result.coverage.resize(static_cast<std::size_t>(bitmap.width) * bitmap.rows);
+
+    for (unsigned int y = 0; y < bitmap.rows; ++y)
+    {
+        const unsigned char *src = std::next(bitmap.buffer, y * bitmap.pitch); // NOLINT
+        unsigned char *dst = std::next(result.coverage.data(), y * bitmap.width);
+        for (unsigned int x = 0; x < bitmap.width; ++x)
         {
-            return {static_cast<unsigned int>(pen_x), font_path};
+            switch (bitmap.pixel_mode)
+            {
+                case FT_PIXEL_MODE_GRAY:
+                    dst[x] = src[x]; // NOLINT
+                    break;
+                case FT_PIXEL_MODE_MONO:
+                    dst[x] = (src[x / 8] & (0x80 >> (x % 8))) ? 0xFF : 0x00; // NOLINT
+                    break;
+                default:
+                    return {};
+            }
         }
     }
+    return result;
+}
 
-    // Work around if we could not find valid font.
-    return {static_cast<unsigned int>(text.size()) * font.fontSize.size, std::string{}};
+MetricsCacheStats EmojiRenderer::metricsCacheStats() const
+{
+    return metrics->stats();
+}
+
+RenderCacheStats EmojiRenderer::pngCacheStats() const
+{
+    return emojies->stats();
+}
+
+RenderCacheStats EmojiRenderer::bitmapCacheStats() const
+{
+    return bitmaps->stats();
 }
 
 EmojiRenderer &EmojiRenderer::instance()
 {
-    static thread_local EmojiRenderer inst;
+    static EmojiRenderer inst;
     return inst;
 }
 
@@ -4,14 +4,18 @@
 #include "font_path_or_family.hpp"
 #include "font_size.hpp"
 
+#include <cstddef>
 #include <cstdint>
-#include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
 namespace emoji {
 
+// FYI: Configurable value. Byte budget of the rendered bitmaps, users which keep own copies of the
+// bitmaps (uploaded to X server) use it too, so memory of all copies is bounded the same way.
+constexpr std::size_t kBitmapCacheBudget = 32u * 1024u * 1024u;
+
 struct EmojiFontRequirement
 {
     font_size::FontPixelSize fontSize;
@@ -25,6 +29,11 @@ struct EmojiFontRequirement
         }
         return fontFaceOrPath < other.fontFaceOrPath; // lexicographical compare
     }
+
+    bool operator==(const EmojiFontRequirement &other) const
+    {
+        return fontSize == other.fontSize && fontFaceOrPath == other.fontFaceOrPath;
+    }
 };
 
 struct EmojiToRender
@@ -45,6 +54,39 @@ struct EmojiToRender
         }
         return font < other.font;
     }
+
+    bool operator==(const EmojiToRender &other) const
+    {
+        return emoji == other.emoji && color == other.color && font == other.font;
+    }
+};
+
+struct EmojiToRenderHash
+{
+    std::size_t operator()(const EmojiToRender &what) const;
+};
+
+/// @brief Not premultiplied RGBA image, 4 bytes per pixel.
+struct RgbaBitmap
+{
+    RgbaBitmap() = default;
+    RgbaBitmap(unsigned int w, unsigned int h) : // NOLINT
+        width(w),
+        height(h)
+    {
+        pixels.resize(static_cast<std::size_t>(width) * static_cast<std::size_t>(height)
+                      * static_cast<std::size_t>(4u));
+    }
+
+    unsigned int width{0u};
+    unsigned int height{0u};
+    std::vector<unsigned char> pixels{}; // RGBA
+
+    [[nodiscard]]
+    bool isValid() const
+    {
+        return width > 0u && height > 0u && !pixels.empty();
+    }
 };
 
 struct PngData
@@ -60,7 +102,78 @@ struct PngData
     }
 };
 
+/// @brief Glyph of the text line positioned by FreeType.
+struct PositionedGlyph
+{
+    unsigned int glyphIndex{0u};
+    // Pixel offset of the glyph origin from the start of the run, kerning is applied.
+    int penX{0};
+};
+
+/// @brief Part of the text line which is drawn by the single font.
+struct FontRun
+{
+    FontPathOrFamily font;
+    std::vector<PositionedGlyph> glyphs;
+    // Pixel offset of the run from the start of the line.
+    int x{0};
+    unsigned int width{0u};
+};
+
+/// @brief Text line converted into glyphs, split into runs of the fonts which have those glyphs.
+struct TextLineLayout
+{
+    std::vector<FontRun> runs;
+    unsigned int width{0u};
+
+    [[nodiscard]]
+    bool isValid() const
+    {
+        return !runs.empty();
+    }
+};
+
+/// @brief 8 bits coverage (alpha) image of the single glyph.
+struct GlyphImage
+{
+    unsigned int width{0u};
+    unsigned int height{0u};
+    // Distance from the glyph origin to the left edge of the image.
+    int left{0};
+    // Distance from the baseline to the top edge of the image.
+    int top{0};
+    int advanceX{0};
+    // Tightly packed rows, width * height bytes.
+    std::vector<unsigned char> coverage;
+};
+
+/// @brief Counters of the glyph advance and kerning cache, those show how often FreeType is called.
+struct MetricsCacheStats
+{
+    std::size_t hits{0u};
+    std::size_t misses{0u};
+
+    [[nodiscard]]
+    double hitRate() const
+    {
+        const auto total = hits + misses;
+        return total > 0u ? static_cast<double>(hits) / static_cast<double>(total) : 0.0;
+    }
+};
+
+/// @brief Counters of the bounded cache of rendered emojis.
+struct RenderCacheStats
+{
+    std::size_t entries{0u};
+    std::size_t bytes{0u};
+    std::size_t hits{0u};
+    std::size_t misses{0u};
+    std::size_t evictions{0u};
+};
+
 /// @brief Does render of the single emoji as base64 encoded PNG.
+/// @note Single instance is shared by all threads. Cached results are looked up concurrently,
+/// FreeType calls are serialized, so cache misses are rendered one at a time.
 class EmojiRenderer
 {
   public:
@@ -69,27 +182,66 @@ class EmojiRenderer
         unsigned int computedWidth;
         // Font selected or empty if fallback was used.
         FontPathOrFamily fontUsedToMeasure;
+        // Measured symbols are [begin; end) of the text.
+        std::size_t begin;
+        std::size_t end;
     };
 
     NO_COPYMOVE(EmojiRenderer);
 
     /// @brief Renders emoji to bitmap if required system libraries were found.
-    /// @returns "tofu" image if it could not render.
-    const PngData &renderToPng(const EmojiToRender &what);
+    /// @returns "tofu" image if it could not render, never nullptr. It stays valid after the
+    /// cache drops it.
+    std::shared_ptr<const PngData> renderToPng(const EmojiToRender &what);
+
+    /// @brief Same as renderToPng() but keeps raw bitmap scaled to the font size, so it can be
+    /// uploaded as is without PNG encode/decode.
+    /// @returns invalid bitmap if it could not render, never nullptr.
+    std::shared_ptr<const RgbaBitmap> renderToBitmap(const EmojiToRender &what);
     ~EmojiRenderer();
 
-    /// @returns computed pixel width of the text string with one of the fonts.
-    TextFontWidth computeWidth(const EmojiFontRequirement &font, const std::vector<char32_t> &text);
+    /// @returns computed pixel widths of the text string split into runs, each symbol is measured
+    /// with the first font which has it.
+    /// @note Advances and kerning are cached per face, size and glyph, so repeated text is
+    /// measured without FreeType calls.
+    std::vector<TextFontWidth> computeWidth(const EmojiFontRequirement &font,
+                                            const std::vector<char32_t> &text);
+
+    /// @brief Converts @p text into glyphs, each symbol is taken from the first font which has it.
+    /// @note Color (emoji) fonts are skipped, those cannot be drawn as coverage masks.
+    /// @returns invalid layout if some symbol is missing in all fonts.
+    TextLineLayout layoutLine(const EmojiFontRequirement &font, const std::vector<char32_t> &text);
+
+    /// @returns coverage image of the glyph previously returned by layoutLine().
+    GlyphImage renderGlyph(const FontPathOrFamily &font, font_size::FontPixelSize fontSize,
+                           unsigned int glyphIndex);
+
+    /// @returns counters of the advance and kerning cache used by computeWidth() and layoutLine().
+    [[nodiscard]]
+    MetricsCacheStats metricsCacheStats() const;
+
+    /// @returns counters of the renderToPng() cache.
+    [[nodiscard]]
+    RenderCacheStats pngCacheStats() const;
+
+    /// @returns counters of the renderToBitmap() cache.
+    [[nodiscard]]
+    RenderCacheStats bitmapCacheStats() const;
 
-    /// @returns reference to static thread_local instance.
+    /// @returns reference to the process-wide instance.
     static EmojiRenderer &instance();
 
   private:
     EmojiRenderer();
 
     class FtLibrary;
+    class GlyphMetricsCache;
+    template <typename T>
+    class RenderCache;
     std::unique_ptr<FtLibrary> library;
-    std::map<EmojiToRender, PngData> emojies;
+    std::unique_ptr<GlyphMetricsCache> metrics;
+    std::unique_ptr<RenderCache<PngData>> emojies;
+    std::unique_ptr<RenderCache<RgbaBitmap>> bitmaps;
 };
 
 } // namespace emoji
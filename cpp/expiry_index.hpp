@@ -0,0 +1,135 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace draw_task {
+
+/// @brief Keeps ids of the items ordered by the time they expire, so expired ones are found
+/// without scanning all items.
+/// @details This is min-heap with lazy deletion: re-armed or disarmed id leaves its old entry in
+/// the heap, which is dropped when it reaches the top. Generations are unique for the index
+/// lifetime, so entries left by disarmed id never match the same id armed again.
+class expiry_index_t
+{
+  public:
+    using time_point = std::chrono::steady_clock::time_point;
+    using deadline_t = std::optional<time_point>;
+
+    /// @brief Sets new @p deadline of the @p id, replacing previous one. Id without deadline
+    /// never expires.
+    void arm(const std::string &id, const deadline_t &deadline)
+    {
+        if (!deadline)
+        {
+            disarm(id);
+            return;
+        }
+        auto &armed = current[id];
+        armed.generation = ++lastGeneration;
+        armed.deadline = *deadline;
+        heap.push({*deadline, armed.generation, id});
+        compactIfBloated();
+    }
+
+    void disarm(const std::string &id)
+    {
+        current.erase(id);
+    }
+
+    /// @brief Calls @p onExpired for each id which deadline is reached at @p now and forgets it.
+    template <typename taCallable>
+    void popExpired(const time_point &now, const taCallable &onExpired)
+    {
+        dropStale();
+        while (!heap.empty() && heap.top().deadline <= now)
+        {
+            const std::string id = heap.top().id;
+            heap.pop();
+            current.erase(id);
+            onExpired(id);
+            dropStale();
+        }
+    }
+
+    /// @returns the earliest deadline of all armed ids, nothing if no id can expire.
+    [[nodiscard]]
+    deadline_t nextDeadline()
+    {
+        dropStale();
+        if (heap.empty())
+        {
+            return std::nullopt;
+        }
+        return heap.top().deadline;
+    }
+
+    void clear()
+    {
+        current.clear();
+        heap = {};
+    }
+
+  private:
+    struct armed_t
+    {
+        std::uint64_t generation{0};
+        time_point deadline;
+    };
+
+    struct entry_t
+    {
+        time_point deadline;
+        std::uint64_t generation;
+        std::string id;
+
+        bool operator>(const entry_t &other) const
+        {
+            return deadline > other.deadline;
+        }
+    };
+
+    std::unordered_map<std::string, armed_t> current;
+    std::uint64_t lastGeneration{0};
+    std::priority_queue<entry_t, std::vector<entry_t>, std::greater<>> heap;
+
+    [[nodiscard]]
+    bool isStale(const entry_t &entry) const
+    {
+        const auto it = current.find(entry.id);
+        return it == current.end() || it->second.generation != entry.generation;
+    }
+
+    void dropStale()
+    {
+        while (!heap.empty() && isStale(heap.top()))
+        {
+            heap.pop();
+        }
+    }
+
+    /// @brief Rebuilds heap when stale entries dominate, i.e. same ids are re-armed often.
+    void compactIfBloated()
+    {
+        constexpr std::size_t kMinSizeToCompact = 64;
+        if (heap.size() < kMinSizeToCompact || heap.size() < current.size() * 2)
+        {
+            return;
+        }
+        std::vector<entry_t> live;
+        live.reserve(current.size());
+        for (const auto &[id, armed] : current)
+        {
+            live.push_back({armed.deadline, armed.generation, id});
+        }
+        heap = decltype(heap){std::greater<>{}, std::move(live)};
+    }
+};
+} // namespace draw_task
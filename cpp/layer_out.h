@@ -6,10 +6,20 @@
 
 #include <cstdint>
 #include <fstream>
+#include <functional>
 #include <iosfwd>
 #include <iostream>
 #include <string>
 
+/// @brief Result of the OutputLayer::processEvents().
+struct TProcessedEvents
+{
+    // Window content must be presented again or background work changed what is drawn.
+    bool needsRepaint{false};
+    // Focus could change or window was shown, so focused application must be checked again.
+    bool windowChanged{false};
+};
+
 // virtual base class (interface) for doing output
 class OutputLayer
 {
@@ -26,8 +36,23 @@ class OutputLayer
     virtual std::string getFocusedWindowBinaryPath() const = 0;
     virtual void showVersionString(const std::string &src, const std::string &color) = 0;
     virtual void draw(const draw_task::drawitem_t &drawitem) = 0;
+    /// @brief Repaints only areas of the screen changed since previous call: areas of the new or
+    /// changed @p items and areas of the items which are not present in @p items anymore.
+    virtual void redrawDamaged(const draw_task::draw_items_t &items) = 0;
     [[nodiscard]]
     virtual bool isTransparencyAvail() const = 0;
+    /// @returns file descriptor which has input when processEvents() should be called.
+    [[nodiscard]]
+    virtual int getEventsFd() const = 0;
+    /// @brief Sets callback which is called from other threads when processEvents() has work done
+    /// in background, i.e. rasterization, to apply.
+    virtual void setWakeup(std::function<void()> wakeup) = 0;
+    /// @brief Handles pending events of the window system and background work without blocking.
+    virtual TProcessedEvents processEvents() = 0;
+    /// @returns true if events were already read from getEventsFd() and wait for processEvents(),
+    /// so fd has no input for them.
+    [[nodiscard]]
+    virtual bool hasQueuedEvents() const = 0;
 
     static std::string getBinaryPathForPid(const std::uint64_t pid)
     {
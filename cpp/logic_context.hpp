@@ -2,31 +2,51 @@
 
 #include "drawables.h"
 #include "runners.h"
+#include "wakeup_event.hpp"
 
 #include <memory>
 #include <mutex>
 #include <utility>
+#include <vector>
 
 /// @brief Ouput context usable by TCP Session to provide data to processing core.
+/// @details Sessions publish parsed batches, processing core takes them all at once and applies to
+/// own scene. Lock is held only to move batches in or out, never while drawing.
 class OutputContext
 {
   public:
-    OutputContext(std::shared_ptr<std::mutex> mut, draw_task::draw_items_t &allDraws) :
+    using batches_t = std::vector<draw_task::draw_items_t>;
+
+    OutputContext(std::shared_ptr<std::mutex> mut, std::shared_ptr<utility::WakeupEvent> wakeup) :
         mut(std::move(mut)),
-        allDraws(allDraws)
+        wakeup(std::move(wakeup))
     {
     }
 
-    template <typename taCallable>
-    void accessContext(const taCallable &callable)
+    /// @brief Passes @p batch to processing core and wakes it up.
+    void publish(draw_task::draw_items_t &&batch)
+    {
+        {
+            const std::lock_guard grd(*mut);
+            published.push_back(std::move(batch));
+        }
+        wakeup->notify();
+    }
+
+    /// @returns all batches published since previous call, in order of publishing.
+    [[nodiscard]]
+    batches_t takePublished()
     {
+        batches_t taken;
         const std::lock_guard grd(*mut);
-        callable(allDraws);
+        std::swap(taken, published);
+        return taken;
     }
 
   private:
     std::shared_ptr<std::mutex> mut;
-    draw_task::draw_items_t &allDraws;
+    std::shared_ptr<utility::WakeupEvent> wakeup;
+    batches_t published;
 };
 
 /// @brief Logic context for TCP accept and TCP session, allows to parse incoming data properly and
@@ -35,7 +55,7 @@ struct LogicContext
 {
     int window_width;
     int window_height;
-    OutputContext outputContext;
+    OutputContext &outputContext;
     utility::runnerint_t shouldStop;
 
     /// @returns true if thread can continue, @returns false when all processing must be stoped now.
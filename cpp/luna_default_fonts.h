@@ -11,12 +11,24 @@
 #include <filesystem>
 #include <iostream>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <unordered_set>
 #include <variant>
 #include <vector>
 
+/// @brief Lunasvg keeps fonts in global cache, which is filled lazily by text rendering too. So
+/// installing of the new font and rendering of the text hold it exclusive, other rendering
+/// threads hold it shared.
+inline std::shared_mutex &LunaFontsMutex()
+{
+    static std::shared_mutex mut;
+    return mut;
+}
+
 /// @brief Tries to add font path to lunasvg once. It is up-to caller to ensure it is exists.
+/// @note Lunasvg's lock is taken only if font is not installed yet, so installed fonts do not wait
+/// for the text rendering.
 inline bool InstallNormalFontFileToLuna(const std::string &path)
 {
     if (path.empty())
@@ -24,21 +36,34 @@ inline bool InstallNormalFontFileToLuna(const std::string &path)
         return false;
     }
 
-    static std::mutex mut;
-    const std::lock_guard grd(mut);
+    static std::mutex installedMutex;
     static std::unordered_set<std::string> installed;
-    if (installed.count(path) == 0)
+    const auto isInstalled = [&path]() {
+        const std::lock_guard grd(installedMutex);
+        return installed.count(path) > 0;
+    };
+    if (isInstalled())
+    {
+        return true;
+    }
+
+    const std::unique_lock grd(LunaFontsMutex());
+    // Other thread could install it while we waited.
+    if (isInstalled())
+    {
+        return true;
+    }
+    if (!lunasvg_add_font_face_from_file("", false, false, path.c_str()))
     {
-        if (lunasvg_add_font_face_from_file("", false, false, path.c_str()))
-        {
-            installed.insert(path);
-#ifndef NDEBUG
-            std::cout << path << " font was loaded.\n";
-#endif
-            return true;
-        }
         return false;
     }
+    {
+        const std::lock_guard installedGrd(installedMutex);
+        installed.insert(path);
+    }
+#ifndef NDEBUG
+    std::cout << path << " font was loaded.\n";
+#endif
     return true;
 }
 
@@ -2,9 +2,12 @@
 
 #include "asio_accept_tcp_server.hpp"
 #include "drawables.h"
+#include "emoji_renderer.hpp"
 #include "logic_context.hpp"
 #include "runners.h"
+#include "scene.hpp"
 #include "strutils.h"
+#include "wakeup_event.hpp"
 #include "xoverlayoutput.h"
 
 #include <asio.hpp> //NOLINT
@@ -19,6 +22,7 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <thread>
 
@@ -28,6 +32,9 @@ const std::string windowClassName = "edmc_linux_overlay_class";
 constexpr unsigned short port = 5010;
 
 std::shared_ptr<std::thread> serverAcceptThread{nullptr};
+// Main thread sleeps on it until something must be done.
+const auto wakeupEvent = std::make_shared<utility::WakeupEvent>();
+
 void sighandler(int signum)
 {
     std::cout << "edmc_linux_overlay: got signal " << signum << std::endl;
@@ -36,9 +43,20 @@ void sighandler(int signum)
     {
         std::cout << "edmc_linux_overlay: SIGINT/SIGTERM, exiting" << std::endl;
         serverAcceptThread.reset();
+        wakeupEvent->notify();
     }
 }
 
+utility::WakeupEvent::TDeadline
+earliest(const utility::WakeupEvent::TDeadline &a, const utility::WakeupEvent::TDeadline &b)
+{
+    if (a && b)
+    {
+        return std::min(*a, *b);
+    }
+    return a ? a : b;
+}
+
 } // namespace
 
 /*
@@ -77,17 +95,27 @@ int main(int argc, char *argv[])
     auto &drawer = XOverlayOutput::get(windowClassName, atoi(argv[1]), atoi(argv[2]), window_width,
                                        window_height);
 
+    drawer.setWakeup([]() {
+        wakeupEvent->notify();
+    });
+
     // std::cout << "edmcoverlay2: overlay starting up..." << std::endl;
     signal(SIGINT, sighandler);
     signal(SIGTERM, sighandler);
 
-    drawer.cleanFrame();
-    drawer.showVersionString("Binary is awaiting connection(s) from EDMC's plugins...", "green");
-    drawer.flushFrame();
+    // It is shown until the first item comes.
+    const auto showStartupString = [&drawer]() {
+        drawer.cleanFrame();
+        drawer.showVersionString("Binary is awaiting connection(s) from EDMC's plugins...",
+                                 "green");
+        drawer.flushFrame();
+    };
+    showStartupString();
     // std::cout << "edmcoverlay2: overlay ready." << std::endl;
 
-    draw_task::draw_items_t allDraws;
-    OutputContext outputContext{std::make_shared<std::mutex>(), allDraws};
+    // It is accessed by main thread only, sessions pass data by outputContext.
+    draw_task::scene_t scene;
+    OutputContext outputContext{std::make_shared<std::mutex>(), wakeupEvent};
 
     serverAcceptThread = utility::startNewRunner(
       [&outputContext, window_height, window_width](const auto &should_close_ptr) {
@@ -105,11 +133,7 @@ int main(int argc, char *argv[])
                   io_context.run();
               });
 
-              while (!(*should_close_ptr))
-              {
-                  std::this_thread::sleep_for(100ms);
-              }
-
+              should_close_ptr->wait();
               io_context.stop();
               if (context_thread.joinable())
               {
@@ -125,10 +149,12 @@ int main(int argc, char *argv[])
     // Main thread loop. It draws and manages remove of the expired items.
     try
     {
-        constexpr auto kAppActivityCheck = 1500ms; // NOLINT
-        auto lastCheckTime = std::chrono::steady_clock::now() - kAppActivityCheck;
+        // Focus changes are reported by events, this check is for the cases when they are not.
+        constexpr auto kAppActivityCheck = 7500ms; // NOLINT
+        auto nextCheckTime = std::chrono::steady_clock::now();
         bool targetAppActive = false;
         bool commandHideLayer = false;
+        bool focusChanged = true;
 
         const std::map<std::string, std::function<bool()>> commandCallbacks = {
           {"exit",
@@ -151,18 +177,16 @@ int main(int argc, char *argv[])
         };
 
         bool window_was_hidden = false;
+        bool startupStringShown = true;
         while (serverAcceptThread)
         {
-            static std::size_t transparencyChecksCounter = 0;
-            std::this_thread::sleep_for(100ms); // NOLINT
-            if (lastCheckTime + kAppActivityCheck < std::chrono::steady_clock::now())
+            const auto events = drawer.processEvents();
+            focusChanged = focusChanged || events.windowChanged;
+            if (nextCheckTime <= std::chrono::steady_clock::now())
             {
-                ++transparencyChecksCounter;
-                lastCheckTime = std::chrono::steady_clock::now();
-                targetAppActive =
-                  programName.empty()
-                  || utility::strcontains(drawer.getFocusedWindowBinaryPath(), programName);
-                if (transparencyChecksCounter % 5 == 0 && !drawer.isTransparencyAvail())
+                nextCheckTime = std::chrono::steady_clock::now() + kAppActivityCheck;
+                focusChanged = true;
+                if (!drawer.isTransparencyAvail())
                 {
                     // It can be some service restart....
                     std::this_thread::sleep_for(500ms); // NOLINT
@@ -173,63 +197,98 @@ int main(int argc, char *argv[])
                     }
                 }
             }
+            if (focusChanged)
+            {
+                focusChanged = false;
+                targetAppActive =
+                  programName.empty()
+                  || utility::strcontains(drawer.getFocusedWindowBinaryPath(), programName);
+            }
 
-            outputContext.accessContext([&](auto &allDraws) {
-                bool skip_render = true;
-                for (auto iter = allDraws.begin(); iter != allDraws.end();)
+            for (auto &batch : outputContext.takePublished())
+            {
+                scene.merge(std::move(batch));
+            }
+
+            auto &allDraws = scene.items;
+            bool skip_render = !events.needsRepaint;
+            scene.expiry.popExpired(std::chrono::steady_clock::now(), [&](const std::string &id) {
+                if (scene.erase(id))
                 {
-                    const bool isCommand = iter->second.isCommand();
-                    if (isCommand)
+                    skip_render = false;
+                }
+            });
+            const auto nextDeadline = earliest(nextCheckTime, scene.expiry.nextDeadline());
+
+            for (auto iter = allDraws.begin(); iter != allDraws.end();)
+            {
+                const bool isCommand = iter->second.isCommand();
+                if (isCommand)
+                {
+                    // std::cout << iter->second.command << std::endl;
+                    const auto cmd_iter = commandCallbacks.find(iter->second.command);
+                    if (cmd_iter != commandCallbacks.end())
                     {
-                        // std::cout << iter->second.command << std::endl;
-                        const auto cmd_iter = commandCallbacks.find(iter->second.command);
-                        if (cmd_iter != commandCallbacks.end())
+                        if (cmd_iter->second())
                         {
-                            if (cmd_iter->second())
-                            {
-                                skip_render = false;
-                                break;
-                            }
+                            skip_render = false;
+                            break;
                         }
                     }
+                }
 
-                    skip_render = skip_render && iter->second.already_rendered;
+                skip_render = skip_render && iter->second.already_rendered;
 
-                    if (isCommand || iter->second.isExpired())
-                    {
-                        skip_render = false;
-                        iter = allDraws.erase(iter);
-                    }
-                    else
-                    {
-                        ++iter;
-                    }
+                if (isCommand)
+                {
+                    skip_render = false;
+                    iter = scene.erase(iter);
                 }
+                else
+                {
+                    ++iter;
+                }
+            }
 
-                if (targetAppActive && !commandHideLayer)
+            if (targetAppActive && !commandHideLayer)
+            {
+                if (startupStringShown && allDraws.empty())
                 {
+                    // Repaint of the empty scene would wipe it.
                     if (!skip_render || window_was_hidden)
                     {
-                        drawer.cleanFrame();
-                        for (auto &drawitem : allDraws)
-                        {
-                            drawer.draw(drawitem.second);
-                            drawitem.second.setAlreadyRendered();
-                        }
-                        drawer.flushFrame();
+                        showStartupString();
                     }
-                    window_was_hidden = false;
                 }
-                else
+                else if (!skip_render || window_was_hidden)
                 {
-                    if (!window_was_hidden)
+                    startupStringShown = false;
+                    // Drawing does not block sessions, they publish to outputContext meanwhile.
+                    drawer.redrawDamaged(allDraws);
+                    for (auto &drawitem : allDraws)
                     {
-                        drawer.cleanFrame();
-                        drawer.flushFrame();
+                        drawitem.second.setAlreadyRendered();
                     }
-                    window_was_hidden = true;
+                    drawer.flushFrame();
                 }
-            });
+                window_was_hidden = false;
+            }
+            else
+            {
+                if (!window_was_hidden)
+                {
+                    drawer.cleanFrame();
+                    drawer.flushFrame();
+                }
+                window_was_hidden = true;
+            }
+
+            // Sleeping until new data, window event or next expiry. Events already read by Xlib
+            // do not make fd readable, so those are handled without sleep.
+            if (!drawer.hasQueuedEvents())
+            {
+                wakeupEvent->wait(drawer.getEventsFd(), nextDeadline);
+            }
         }
     }
     catch (...)
@@ -238,8 +297,18 @@ int main(int argc, char *argv[])
     }
 
     serverAcceptThread.reset();
-    outputContext.accessContext([](auto &allDraws) {
-        std::cout << "Final cleanup: " << allDraws.size() << " items left." << std::endl;
-    });
+    std::cout << "Final cleanup: " << scene.items.size() << " items left." << std::endl;
+#ifndef NDEBUG
+    const auto metricsStats = emoji::EmojiRenderer::instance().metricsCacheStats();
+    std::cout << "Glyph metrics cache: " << metricsStats.hits << " hits, " << metricsStats.misses
+              << " misses, hit rate " << metricsStats.hitRate() << std::endl;
+    const auto printRenderStats = [](const char *name, const emoji::RenderCacheStats &stats) {
+        std::cout << name << " cache: " << stats.entries << " entries, " << stats.bytes
+                  << " bytes, " << stats.hits << " hits, " << stats.misses << " misses, "
+                  << stats.evictions << " evictions" << std::endl;
+    };
+    printRenderStats("Emoji PNG", emoji::EmojiRenderer::instance().pngCacheStats());
+    printRenderStats("Emoji bitmap", emoji::EmojiRenderer::instance().bitmapCacheStats());
+#endif
     return 0;
 }
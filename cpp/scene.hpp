@@ -0,0 +1,126 @@
+#pragma once
+
+#include "cm_ctors.h"
+#include "drawables.h"
+#include "expiry_index.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace draw_task {
+
+/// @brief Items to be drawn and their expiry index. It is owned by render thread only, so it is
+/// never locked.
+/// @note Items must be added and removed by the methods of the scene, so index of the content is
+/// kept in sync.
+struct scene_t
+{
+    scene_t() = default;
+    // Index keeps iterators of the items.
+    NO_COPYMOVE(scene_t);
+
+    draw_items_t items;
+    expiry_index_t expiry;
+    std::uint64_t lastGeneration{0};
+
+    /// @brief Adds or replaces items by @p incoming ones. It costs O(k log n) for k incoming
+    /// items, renamed duplicates are found by hash of the content.
+    void merge(draw_items_t incoming)
+    {
+        while (!incoming.empty())
+        {
+            auto node = incoming.extract(incoming.begin());
+            auto &drawitem = node.mapped();
+            drawitem.generation = ++lastGeneration;
+            expiry.arm(node.key(), drawitem.ttl.deadline());
+
+            auto it = items.lower_bound(node.key());
+            if (it != items.end() && it->first == node.key())
+            {
+                // Anti-flickering support.
+                if (drawitem.contentHash == it->second.contentHash
+                    && drawitem.isEqualStoredData(it->second))
+                {
+                    drawitem.setAlreadyRendered();
+                }
+                unindex(it);
+                it->second = std::move(drawitem);
+            }
+            else
+            {
+                it = items.insert(it, std::move(node));
+            }
+            byContent.emplace(it->second.contentHash, it);
+            removeRenamedDuplicates(it);
+        }
+    }
+
+    /// @returns iterator following the erased item.
+    draw_items_t::iterator erase(draw_items_t::iterator it)
+    {
+        expiry.disarm(it->first);
+        unindex(it);
+        return items.erase(it);
+    }
+
+    /// @returns true if item with @p id was erased.
+    bool erase(const std::string &id)
+    {
+        const auto it = items.find(id);
+        if (it == items.end())
+        {
+            return false;
+        }
+        erase(it);
+        return true;
+    }
+
+  private:
+    // Items by the hash of the content, full compare is done only for the same hash.
+    std::unordered_multimap<std::uint64_t, draw_items_t::iterator> byContent;
+
+    void unindex(draw_items_t::iterator it)
+    {
+        const auto [first, last] = byContent.equal_range(it->second.contentHash);
+        const auto found =
+          std::find_if(first, last, [&it](const auto &entry) { return entry.second == it; });
+        if (found != last)
+        {
+            byContent.erase(found);
+        }
+    }
+
+    /// @brief Drops item which draws the same as @p changed one under other id, so renamed item
+    /// is not drawn twice. The newer of them is kept.
+    /// @note Scene has no duplicates before @p changed is put, so there is at most one.
+    void removeRenamedDuplicates(draw_items_t::iterator changed)
+    {
+        const auto [first, last] = byContent.equal_range(changed->second.contentHash);
+        const auto found = std::find_if(first, last, [&changed](const auto &entry) {
+            return entry.second != changed
+                   && entry.second->second.isEqualStoredData(changed->second);
+        });
+        if (found == last)
+        {
+            return;
+        }
+
+        const auto dup = found->second;
+        const bool rendered = changed->second.already_rendered || dup->second.already_rendered;
+        auto dropped = dup;
+        if (changed->second.ttl.created_at < dup->second.ttl.created_at)
+        {
+            dup->second.already_rendered = rendered;
+            dropped = changed;
+        }
+        else
+        {
+            changed->second.already_rendered = rendered;
+        }
+        erase(dropped);
+    }
+};
+} // namespace draw_task
@@ -35,11 +35,9 @@ namespace {
  * than display that SVG shifted back to screen coordinates.
  */
 
-constexpr int kTabSizeInSpaces = 2;
-constexpr int kMarkerHalfSize = 4;
-constexpr int kStrokeWidth = 1;
-constexpr int kTextOffsetX = 1;
-constexpr int kTextOffsetY = 0;
+constexpr int kMarkerHalfSize = draw_task::TMarkerInVectorInShape::kHalfSize;
+constexpr int kStrokeWidth = draw_task::drawitem_t::drawshape_t::kStrokeWidth;
+constexpr int kTextOffsetY = draw_task::TMarkerInVectorInShape::kTextOffsetY;
 
 std::string escape_for_svg(std::string_view in)
 {
@@ -83,29 +81,21 @@ class TextToSvgConverter
         state{}
     {
         assert(drawTask.drawmode == draw_task::drawmode_t::text);
-        static const std::string nbsp = "\xC2\xA0";
-        textToDraw = utility::replace_tabs_with_spaces(
-          drawTask.text.text.empty() ? nbsp : drawTask.text.text, kTabSizeInSpaces);
     }
 
     /// @brief Does actual conversion and puts result into @p svgOutStream.
     void generateSvg(std::ostringstream &svgOutStream)
     {
-        std::istringstream iss(textToDraw);
-        std::string line;
         state.y = drawTask.y;
-        while (std::getline(iss, line))
+        for (const auto &line : drawTask.text.getLinesToDraw())
         {
             state.x = drawTask.x;
             processSingleLine(svgOutStream, line);
-            state.y += static_cast<int>(
-              kYSpacing * static_cast<float>(drawTask.text.getFinalFontSize().size));
+            state.y += drawTask.text.getLineHeight();
         }
     }
 
   private:
-    static constexpr float kYSpacing = 1.05f;
-
     struct RenderState
     {
         unsigned int x{0};
@@ -114,7 +104,6 @@ class TextToSvgConverter
 
     const draw_task::drawitem_t &drawTask;
     RenderState state;
-    std::string textToDraw;
 
   protected:
     /// @brief process single line of the source text: split into possible <text> and <image>
@@ -156,7 +145,9 @@ class TextToSvgConverter
         using namespace emoji;
 
         EmojiFontRequirement font{drawTask.text.getFinalFontSize(), GetEmojiFonts()};
-        const auto &png = EmojiRenderer::instance().renderToPng({symbol, std::move(font)});
+        // Keeps PNG alive even if the cache drops it meanwhile.
+        const auto rendered = EmojiRenderer::instance().renderToPng({symbol, std::move(font)});
+        const auto &png = *rendered;
         if (!png.isValid())
         {
 #ifndef NDEBUG
@@ -191,30 +182,41 @@ class TextToSvgConverter
               return stringfmt(R"(font-family="%s")", fam);
           },
         };
-        const auto measure = measureWidhtOfText(sub);
-        svgOutStream << stringfmt(
-          R"(<text x="%upx" y="%upx" font-size="%upx" fill="%s" %s xml:space='preserve'>)", state.x,
-          state.y + drawTask.text.getFinalFontSize().size, drawTask.text.getFinalFontSize(),
-          drawTask.color, std::visit(getMeasuredFontFam, measure.fontUsedToMeasure))
-                     << escape_for_svg(sub) << "</text>";
-        state.x += measure.computedWidth;
+        std::vector<char32_t> symbols;
+        // Byte offsets of the symbols in the sub, plus end of the sub.
+        std::vector<std::size_t> offsets;
+        symbols.reserve(sub.size());
+        for (UnicodeSymbolsIterator iter(sub); iter.next();)
+        {
+            symbols.emplace_back(iter.symbol());
+            offsets.emplace_back(iter.getStartIndex());
+        }
+        offsets.emplace_back(sub.size());
+
+        // Each run has own font, so lunasvg does not need to guess fallback for the symbols.
+        for (const auto &measure : measureWidhtOfText(symbols))
+        {
+            const auto part =
+              sub.substr(offsets[measure.begin], offsets[measure.end] - offsets[measure.begin]);
+            svgOutStream << stringfmt(
+              R"(<text x="%upx" y="%upx" font-size="%upx" fill="%s" %s xml:space='preserve'>)",
+              state.x, state.y + drawTask.text.getFinalFontSize().size,
+              drawTask.text.getFinalFontSize(), drawTask.color,
+              std::visit(getMeasuredFontFam, measure.fontUsedToMeasure))
+                         << escape_for_svg(part) << "</text>";
+            state.x += measure.computedWidth;
+        }
     }
 
     /// @brief tries to measure the width of text rendered by luasvg for <text> tag.
     /// @note we can set precise Latin font used and measure it, but for bitmap fonts we're doing
     /// guessings there. We find some font, but luasvg could find another.
     [[nodiscard]]
-    emoji::EmojiRenderer::TextFontWidth measureWidhtOfText(const std::string &text) const
+    std::vector<emoji::EmojiRenderer::TextFontWidth>
+    measureWidhtOfText(const std::vector<char32_t> &text) const
     {
-        std::vector<char32_t> txt;
-        txt.reserve(text.size());
-        for (UnicodeSymbolsIterator iter(text); iter.next();)
-        {
-            txt.emplace_back(iter.symbol());
-        }
-
         const emoji::EmojiFontRequirement font{drawTask.text.getFinalFontSize(), GetTextFonts()};
-        return emoji::EmojiRenderer::instance().computeWidth(font, txt);
+        return emoji::EmojiRenderer::instance().computeWidth(font, text);
     }
 };
 
@@ -261,14 +263,7 @@ void makeSvgShape(std::ostringstream &svgOutStream, const draw_task::drawitem_t
 
         if (marker.HasText())
         {
-            draw_task::drawitem_t textTask;
-            textTask.drawmode = draw_task::drawmode_t::text;
-            textTask.x = marker.x + kMarkerHalfSize + kTextOffsetX;
-            textTask.y = marker.y - kTextOffsetY;
-            textTask.color = marker.color;
-            textTask.text.fontSize = vector_font_size;
-            textTask.text.text = marker.text;
-            makeSvgTextMultiline(svgOutStream, textTask);
+            makeSvgTextMultiline(svgOutStream, marker.MakeTextTask(vector_font_size));
         }
     };
 
@@ -306,11 +301,10 @@ draw_task::drawitem_t SvgBuilder::BuildSvgTask() const
         int maxX = std::numeric_limits<int>::min();
         int maxY = std::numeric_limits<int>::min();
 
-        for (const auto &node_ : drawTask.shape.vect.items())
+        for (const auto &point : drawTask.shape.points)
         {
-            const auto &val = node_.value();
-            const int x = val["x"].get<int>();
-            const int y = val["y"].get<int>();
+            const int x = point.x;
+            const int y = point.y;
 
             minX = std::min(minX, x);
             minY = std::min(minY, y);
@@ -321,7 +315,7 @@ draw_task::drawitem_t SvgBuilder::BuildSvgTask() const
         auto width = maxX - minX;
         auto height = maxY - minY;
 
-        if (drawTask.shape.vect.size() == 1)
+        if (drawTask.shape.points.size() == 1)
         {
             height =
               2 * kMarkerHalfSize + 1 + drawTask.shape.getFinalFontSize().size + kTextOffsetY;
@@ -2,19 +2,25 @@
 
 #include "drawables.h"
 #include "logic_context.hpp"
-#include "svgbuilder.h"
+#include "wire_decoder.hpp"
+#include "wire_format.hpp"
 
 #include <asio.hpp> // NOLINT
 
 #include <algorithm>
+#include <charconv>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <exception>
 #include <iostream>
-#include <iterator>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <system_error>
 #include <utility>
+#include <vector>
 
 class TcpSession : public std::enable_shared_from_this<TcpSession>
 {
@@ -24,73 +30,190 @@ class TcpSession : public std::enable_shared_from_this<TcpSession>
         socket_(std::move(socket)),
         logicContext_(std::move(logicContext))
     {
+        buffer_.resize(kDefaultBufferSize);
     }
 
     void start()
     {
-        readHeader();
+        readSome();
     }
 
   private:
-    /// @brief Message is: numeric+len#body
-    void readHeader()
+    // FYI: Configurable values. Buffer grows to fit the single message and shrinks back once
+    // there is no incomplete message in it.
+    static constexpr std::size_t kDefaultBufferSize = 64u * 1024u;
+    static constexpr std::size_t kMaxMessageSize = 64u * 1024u * 1024u;
+    // Decimal length longer than that is garbage anyway.
+    static constexpr std::size_t kMaxHeaderSize = 20u;
+
+    /// @brief Reads whatever is available into the free tail of the buffer, all complete messages
+    /// received are processed in place.
+    void readSome()
     {
         auto self(shared_from_this());
-        asio::async_read_until( // NOLINT
-          socket_, stream_buffer_, '#', [this, self](std::error_code ec, std::size_t /*length*/) {
-              if (!ec)
+        socket_.async_read_some( // NOLINT
+          asio::buffer(std::next(buffer_.data(), end_), buffer_.size() - end_),
+          [this, self](std::error_code ec, std::size_t length) {
+              if (ec)
+              {
+                  return;
+              }
+              end_ += length;
+              if (!processFrames())
               {
-                  std::istream is(&stream_buffer_);
-                  std::string header;
-                  if (std::getline(is, header, '#'))
-                  {
-                      try
-                      {
-                          const std::size_t body_size = std::stoul(header);
-                          readBody(body_size);
-                      }
-                      catch (const std::exception &e)
-                      {
-                          std::cerr << "PROTOCOL ERROR: Invalid length string '" << header
-                                    << "' Error: " << e.what() << std::endl;
-                          stream_buffer_.consume(stream_buffer_.size());
-                          std::error_code ignore_ec;
-                          socket_.close(ignore_ec);
-                      }
-                  }
+                  std::error_code ignore_ec;
+                  socket_.close(ignore_ec);
+                  return;
               }
+              // Keep-Alive!
+              readSome();
           });
     }
 
-    /// @brief Reads body of the message of length @p size and tries to parse it as json, translate
-    /// to internal objects according LogicContext passed on construction.
-    void readBody(std::size_t size)
+    /// @brief Processes all complete messages of the buffer, so pipelined burst is handled at
+    /// once, and prepares buffer for the next read. The first byte of the connection selects
+    /// protocol: wire::kMagic means binary frames, anything else is json messages.
+    /// @returns false on protocol error.
+    bool processFrames()
     {
-        auto self(shared_from_this());
-        const std::size_t to_read =
-          (size > stream_buffer_.size()) ? (size - stream_buffer_.size()) : 0;
-        asio::async_read(socket_, // NOLINT
-                         stream_buffer_,
-                         asio::transfer_exactly(to_read), // NOLINT
-                         [this, self, size](std::error_code ec, std::size_t /*length*/) {
-                             if (!ec)
-                             {
-                                 std::string body;
-                                 body.resize(size);
-                                 std::istream is(&stream_buffer_);
-                                 is.read(&body[0], size);
-                                 process_payload(body);
-
-                                 // Keep-Alive!
-                                 // TODO: uncomment code to keep connection
-                                 readHeader();
-                             }
-                         });
+        if (protocol_ == protocol_t::unknown && begin_ < end_)
+        {
+            const auto first = static_cast<unsigned char>(buffer_[begin_]);
+            protocol_ = first == wire::kMagic ? protocol_t::binary : protocol_t::json;
+            if (protocol_ == protocol_t::binary)
+            {
+                ++begin_;
+            }
+        }
+
+        while (begin_ < end_)
+        {
+            const std::string_view pending(std::next(buffer_.data(), begin_), end_ - begin_);
+            const auto consumed = protocol_ == protocol_t::binary ? processBinaryFrame(pending)
+                                                                  : processJsonFrame(pending);
+            if (!consumed)
+            {
+                return false;
+            }
+            if (*consumed == 0u)
+            {
+                break;
+            }
+            begin_ += *consumed;
+        }
+
+        if (begin_ == end_)
+        {
+            begin_ = end_ = 0;
+            if (buffer_.size() > kDefaultBufferSize)
+            {
+                buffer_.resize(kDefaultBufferSize);
+                buffer_.shrink_to_fit();
+            }
+        }
+        else if (begin_ > 0 && end_ == buffer_.size())
+        {
+            // Incomplete message reached the end, moving it to the front gives space to read.
+            std::memmove(buffer_.data(), std::next(buffer_.data(), begin_), end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        return true;
+    }
+
+    /// @brief Message is: numeric+len#body.
+    /// @returns size of the processed message, 0 if it is incomplete or nullopt on error.
+    std::optional<std::size_t> processJsonFrame(std::string_view pending)
+    {
+        const auto separator = pending.find('#');
+        if (separator == std::string_view::npos)
+        {
+            if (pending.size() > kMaxHeaderSize)
+            {
+                std::cerr << "PROTOCOL ERROR: Length is not terminated by '#'." << std::endl;
+                return std::nullopt;
+            }
+            return 0u;
+        }
+
+        auto header = pending.substr(0, separator);
+        // Same as std::stoul() did, leading whitespace is skipped, so messages sent by telnet or
+        // separated by spaces / new lines are accepted.
+        header.remove_prefix(std::min(header.find_first_not_of(" \t\r\n"), header.size()));
+        std::size_t body_size = 0;
+        const auto *header_end = std::next(header.data(), header.size());
+        const auto [parsed_end, parse_ec] = std::from_chars(header.data(), header_end, body_size);
+        if (header.empty() || parse_ec != std::errc{} || parsed_end != header_end
+            || body_size > kMaxMessageSize)
+        {
+            std::cerr << "PROTOCOL ERROR: Invalid length string '" << header << "'" << std::endl;
+            return std::nullopt;
+        }
+
+        const std::size_t frame_size = separator + 1 + body_size;
+        if (pending.size() < frame_size)
+        {
+            reserveFrame(frame_size);
+            return 0u;
+        }
+        process_payload(pending.substr(separator + 1, body_size));
+        return frame_size;
+    }
+
+    /// @brief Message is: fixed header + body, see wire_format.hpp.
+    /// @returns size of the processed message, 0 if it is incomplete or nullopt on error.
+    std::optional<std::size_t> processBinaryFrame(std::string_view pending)
+    {
+        if (pending.size() < wire::kHeaderSize)
+        {
+            return 0u;
+        }
+        const auto header = wire::frame_header_t::read(pending.data());
+        if (header.bodySize > kMaxMessageSize)
+        {
+            std::cerr << "PROTOCOL ERROR: Binary message is too big." << std::endl;
+            return std::nullopt;
+        }
+
+        const std::size_t frame_size = wire::kHeaderSize + header.bodySize;
+        if (pending.size() < frame_size)
+        {
+            reserveFrame(frame_size);
+            return 0u;
+        }
+        try
+        {
+            const auto body = pending.substr(wire::kHeaderSize, header.bodySize);
+            publish(wireDecoder_.decode(header, body));
+        }
+        catch (std::exception &e)
+        {
+            // Strings table may be out of sync now, so connection cannot continue.
+            std::cerr << "PROTOCOL ERROR: " << e.what() << std::endl;
+            return std::nullopt;
+        }
+        return frame_size;
+    }
+
+    /// @brief Makes sure that incomplete message of @p frame_size fits the buffer.
+    void reserveFrame(std::size_t frame_size)
+    {
+        if (begin_ + frame_size <= buffer_.size())
+        {
+            return;
+        }
+        if (begin_ > 0)
+        {
+            std::memmove(buffer_.data(), std::next(buffer_.data(), begin_), end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        buffer_.resize(std::max(buffer_.size(), frame_size));
     }
 
     /// @brief Does actual json parsing according to internal logic.
-    /// Fills provided OutputContext by new data received.
-    void process_payload(const std::string &json_str)
+    /// Publishes new data received to provided OutputContext.
+    void process_payload(std::string_view json_str)
     {
         draw_task::draw_items_t incoming_draws;
         try
@@ -109,81 +232,29 @@ class TcpSession : public std::enable_shared_from_this<TcpSession>
             incoming_draws.clear();
         }
 
-        if (!incoming_draws.empty())
-        {
-            // Get rid of all drawables, convert them into SVG.
-            for (auto &element : incoming_draws)
-            {
-                auto svgTask = SvgBuilder(logicContext_.window_width, logicContext_.window_height,
-                                          std::move(element.second))
-                                 .BuildSvgTask();
-                element.second = std::move(svgTask);
-            }
-
-            if (!logicContext_.canContinue())
-            {
-                return;
-            }
-
-            logicContext_.outputContext.accessContext([this, &incoming_draws](auto &allDraws) {
-                incoming_draws.merge(allDraws);
-                // Anti-flickering support.
-                if (!allDraws.empty())
-                {
-                    for (const auto &old : allDraws)
-                    {
-                        if (!logicContext_.canContinue())
-                        {
-                            break;
-                        }
-                        const auto it = incoming_draws.find(old.first);
-                        if (it != incoming_draws.end())
-                        {
-                            if (it->second.isEqualStoredData(old.second))
-                            {
-                                it->second.setAlreadyRendered();
-                            }
-                        }
-                    }
-                    allDraws.clear();
-                }
-                removeRenamedDuplicates(incoming_draws);
-                std::swap(allDraws, incoming_draws);
-            });
-        }
+        publish(std::move(incoming_draws));
     }
 
-    static void removeRenamedDuplicates(draw_task::draw_items_t &src)
+    void publish(draw_task::draw_items_t &&incoming_draws)
     {
-        for (auto iter = src.begin(); iter != std::prev(src.end());)
+        if (!incoming_draws.empty() && logicContext_.canContinue())
         {
-            const auto dup = std::find_if(std::next(iter), src.end(), [&iter](const auto &item) {
-                return item.second.isEqualStoredData(iter->second);
-            });
-
-            if (dup == src.end())
-            {
-                ++iter;
-            }
-            else
-            {
-                const bool rendered = iter->second.already_rendered || dup->second.already_rendered;
-                if (iter->second.ttl.created_at < dup->second.ttl.created_at)
-                {
-                    dup->second.already_rendered = rendered;
-                    iter = src.erase(iter);
-                }
-                else
-                {
-                    iter->second.already_rendered = rendered;
-                    src.erase(dup);
-                    ++iter;
-                }
-            }
+            logicContext_.outputContext.publish(std::move(incoming_draws));
         }
     }
 
+    enum class protocol_t : std::uint8_t {
+        unknown,
+        json,
+        binary,
+    };
+
     asio::ip::tcp::socket socket_;
-    asio::streambuf stream_buffer_;
+    protocol_t protocol_{protocol_t::unknown};
+    draw_task::wire_decoder_t wireDecoder_;
+    // Received bytes are [begin_; end_) of the buffer.
+    std::vector<char> buffer_;
+    std::size_t begin_{0u};
+    std::size_t end_{0u};
     LogicContext logicContext_;
 };
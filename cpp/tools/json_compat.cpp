@@ -0,0 +1,402 @@
+#include "drawables.h"
+
+#include <nlohmann/json.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Parses json messages by the original DOM parser and by the SAX one, which replaced it, and
+// checks that both produce the same items. Exit code is 0 if all messages are parsed the same.
+
+namespace {
+
+using json = nlohmann::json;
+using draw_task::drawmode_t;
+
+/// @brief Fields of the parsed item, which affect drawing.
+struct TParsedItem
+{
+    std::string id;
+    drawmode_t drawmode{drawmode_t::idk};
+    int x{0};
+    int y{0};
+    std::string color;
+    std::string text;
+    std::string size;
+    std::optional<std::uint32_t> fontSize;
+    std::string svg;
+    std::string css;
+    std::string fontFile;
+    std::string shape;
+    std::string fill;
+    int w{0};
+    int h{0};
+    std::uint32_t vectorFontSize{0};
+    long long ttl{-1};
+    std::string command;
+    std::vector<std::array<int, 4>> lines;
+    std::vector<std::tuple<int, int, std::string, std::string, std::string>> markers;
+
+    bool operator==(const TParsedItem &other) const
+    {
+        static const auto tie = [](const TParsedItem &val) {
+            return std::tie(val.id, val.drawmode, val.x, val.y, val.color, val.text, val.size,
+                            val.fontSize, val.svg, val.css, val.fontFile, val.shape, val.fill,
+                            val.w, val.h, val.vectorFontSize, val.ttl, val.command, val.lines,
+                            val.markers);
+        };
+        return tie(*this) == tie(other);
+    }
+};
+
+/// @returns parsed items by id, automatic ids are replaced by their index, because counters of
+/// the parsers differ.
+using TParsedItems = std::map<std::string, TParsedItem>;
+
+std::string stableId(const std::string &id, std::size_t &autoIds)
+{
+    static const std::string kAutoPrefix = "AUTOID:";
+    if (id.rfind(kAutoPrefix, 0) == 0)
+    {
+        return kAutoPrefix + std::to_string(autoIds++);
+    }
+    return id;
+}
+
+/// @brief Copy of the original parser, which kept "vector" as json and walked it while drawing.
+TParsedItems parseByDom(const std::string &src)
+{
+    const std::map<std::string, std::function<void(const json &, TParsedItem &, json &)>>
+      processors = {
+        {"x",
+         [](const json &node, TParsedItem &item, json &) {
+             item.x = node.get<int>();
+         }},
+        {"y",
+         [](const json &node, TParsedItem &item, json &) {
+             item.y = node.get<int>();
+         }},
+        {"w",
+         [](const json &node, TParsedItem &item, json &) {
+             item.drawmode = drawmode_t::shape;
+             item.w = node.get<int>();
+         }},
+        {"h",
+         [](const json &node, TParsedItem &item, json &) {
+             item.drawmode = drawmode_t::shape;
+             item.h = node.get<int>();
+         }},
+        {"color",
+         [](const json &node, TParsedItem &item, json &) {
+             item.color = node.get<std::string>();
+         }},
+        {"text",
+         [](const json &node, TParsedItem &item, json &) {
+             item.drawmode = drawmode_t::text;
+             item.text = node.get<std::string>();
+         }},
+        {"svg",
+         [](const json &node, TParsedItem &item, json &) {
+             item.drawmode = drawmode_t::svg;
+             item.svg = node.get<std::string>();
+         }},
+        {"css",
+         [](const json &node, TParsedItem &item, json &) {
+             item.drawmode = drawmode_t::svg;
+             item.css = node.get<std::string>();
+         }},
+        {"size",
+         [](const json &node, TParsedItem &item, json &) {
+             item.drawmode = drawmode_t::text;
+             item.size = node.get<std::string>();
+         }},
+        {"font_size",
+         [](const json &node, TParsedItem &item, json &) {
+             item.drawmode = drawmode_t::text;
+             item.fontSize = node.get<std::uint32_t>();
+         }},
+        {"font_file",
+         [](const json &node, TParsedItem &item, json &) {
+             item.drawmode = drawmode_t::svg;
+             item.fontFile = node.get<std::string>();
+         }},
+        {"vector_font_size",
+         [](const json &node, TParsedItem &item, json &) {
+             item.drawmode = drawmode_t::shape;
+             item.vectorFontSize = node.get<std::uint32_t>();
+         }},
+        {"shape",
+         [](const json &node, TParsedItem &item, json &) {
+             item.drawmode = drawmode_t::shape;
+             item.shape = node.get<std::string>();
+         }},
+        {"fill",
+         [](const json &node, TParsedItem &item, json &) {
+             item.drawmode = drawmode_t::shape;
+             item.fill = node.get<std::string>();
+         }},
+        {"vector",
+         [](const json &node, TParsedItem &item, json &vect) {
+             item.drawmode = drawmode_t::shape;
+             vect = node;
+         }},
+        {"ttl",
+         [](const json &node, TParsedItem &item, json &) {
+             item.ttl = node.get<int>();
+         }},
+        {"id",
+         [](const json &node, TParsedItem &item, json &) {
+             item.id = node.get<std::string>();
+         }},
+        {"msgid",
+         [](const json &node, TParsedItem &item, json &) {
+             item.id = node.get<std::string>();
+         }},
+        {"shapeid",
+         [](const json &node, TParsedItem &item, json &) {
+             item.id = node.get<std::string>();
+         }},
+        {"svgid",
+         [](const json &node, TParsedItem &item, json &) {
+             item.id = node.get<std::string>();
+         }},
+        {"command",
+         [](const json &node, TParsedItem &item, json &) {
+             item.command = node.get<std::string>();
+         }},
+      };
+
+    // Drawing of the "vect" shape walked points until the first broken one.
+    const auto walkVector = [](const json &vect, TParsedItem &item) {
+        bool hasFirst = false;
+        int prevX = 0;
+        int prevY = 0;
+        for (const auto &node : vect.items())
+        {
+            const auto &val = node.value();
+            int x = 0;
+            int y = 0;
+            std::string color;
+            std::string type;
+            std::string text;
+            try
+            {
+                x = val.at("x").get<int>();
+                y = val.at("y").get<int>();
+                const auto getStr = [&val](const char *key) -> std::string {
+                    return val.contains(key) ? val[key].get<std::string>() : std::string{};
+                };
+                color = getStr("color");
+                type = getStr("marker");
+                text = getStr("text");
+            }
+            catch (const std::exception &)
+            {
+                break;
+            }
+            if (!color.empty())
+            {
+                item.markers.emplace_back(x, y, color, type, text);
+            }
+            if (hasFirst)
+            {
+                item.lines.push_back({prevX, prevY, x, y});
+            }
+            hasFirst = true;
+            prevX = x;
+            prevY = y;
+        }
+    };
+
+    TParsedItems result;
+    std::size_t autoIds = 0u;
+    const auto parseSingleObject = [&](const json &object) {
+        TParsedItem item;
+        json vect;
+        for (const auto &kv : object.items())
+        {
+            const auto it = processors.find(kv.key());
+            if (it == processors.end())
+            {
+                continue;
+            }
+            const auto prevMode = item.drawmode;
+            it->second(kv.value(), item, vect);
+            if (prevMode != drawmode_t::idk && item.drawmode != prevMode)
+            {
+                item.drawmode = drawmode_t::idk;
+                break;
+            }
+        }
+        if (item.drawmode == drawmode_t::idk && item.command.empty())
+        {
+            return;
+        }
+        if (item.id.empty())
+        {
+            item.id = "AUTOID:";
+            if (item.ttl < 0)
+            {
+                item.ttl = 60;
+            }
+        }
+        if (item.drawmode == drawmode_t::shape && item.shape == "vect")
+        {
+            walkVector(vect, item);
+        }
+        item.id = stableId(item.id, autoIds);
+        result[item.id] = item;
+    };
+
+    const auto src_json = json::parse(src);
+    if (src_json.is_array())
+    {
+        for (const auto &element : src_json)
+        {
+            parseSingleObject(element);
+        }
+    }
+    else
+    {
+        parseSingleObject(src_json);
+    }
+    return result;
+}
+
+TParsedItems parseBySax(const std::string &src)
+{
+    TParsedItems result;
+    std::size_t autoIds = 0u;
+    for (const auto &[id, drawitem] : draw_task::parseJsonString(src))
+    {
+        TParsedItem item;
+        item.id = stableId(id, autoIds);
+        item.drawmode = drawitem.drawmode;
+        item.x = drawitem.x;
+        item.y = drawitem.y;
+        item.color = drawitem.color;
+        item.text = drawitem.text.text;
+        item.size = drawitem.text.size;
+        if (drawitem.text.fontSize)
+        {
+            item.fontSize = drawitem.text.fontSize->size;
+        }
+        item.svg = drawitem.svg.svg;
+        item.css = drawitem.svg.css;
+        item.fontFile = drawitem.svg.fontFile;
+        item.shape = drawitem.shape.shape;
+        item.fill = drawitem.shape.fill;
+        item.w = drawitem.shape.w;
+        item.h = drawitem.shape.h;
+        item.vectorFontSize = drawitem.shape.vector_font_size.size;
+        item.ttl = drawitem.ttl.ttl.count();
+        item.command = drawitem.command;
+        draw_task::ForEachVectorPointsPair(
+          drawitem,
+          [&item](int x1, int y1, int x2, int y2) {
+              item.lines.push_back({x1, y1, x2, y2});
+          },
+          [&item](const draw_task::TMarkerInVectorInShape &marker, auto) {
+              item.markers.emplace_back(marker.x, marker.y, marker.color, marker.type,
+                                        marker.text);
+          });
+        result[item.id] = item;
+    }
+    return result;
+}
+
+/// @returns parsed items or nullopt if parser threw.
+std::optional<TParsedItems> tryParse(TParsedItems (*parser)(const std::string &),
+                                     const std::string &src)
+{
+    try
+    {
+        return parser(src);
+    }
+    catch (const std::exception &)
+    {
+        return std::nullopt;
+    }
+}
+
+// Messages which plugins send, including the odd ones which were accepted.
+const std::vector<std::string> kMessages = {
+  // Single object and array.
+  R"({"id": "t1", "text": "Low fuel", "size": "normal", "color": "red", "x": 10, "y": 20,
+      "ttl": 8})",
+  R"([{"id": "t1", "text": "a", "x": 1, "y": 2}, {"id": "t2", "text": "b", "font_size": 50}])",
+  R"([])",
+  // Floating point and boolean numbers.
+  R"({"id": "f", "text": "a", "x": 10.7, "y": -3.2, "ttl": 1.9})",
+  R"({"id": "b", "text": "a", "x": true, "y": false})",
+  // String instead of number fails whole message.
+  R"({"id": "s", "text": "a", "x": "10", "y": 20})",
+  R"({"id": "s", "text": 5})",
+  // Ids by different keys and their precedence.
+  R"({"msgid": "m", "text": "a"})",
+  R"({"shapeid": "r", "shape": "rect", "color": "red", "fill": "green", "x": 1, "y": 2, "w": 3,
+      "h": 4})",
+  R"({"svgid": "g", "svg": "<svg/>", "css": "a{}", "font_file": "/tmp/font.ttf"})",
+  R"({"svgid": "g", "id": "i", "msgid": "m", "shapeid": "s", "text": "a"})",
+  R"({"id": "i", "msgid": "m", "text": "a"})",
+  R"({"shapeid": "s", "msgid": "m", "text": "a"})",
+  // Vectors with markers, broken points and not array ones.
+  R"({"shapeid": "v", "shape": "vect", "color": "green", "vector_font_size": 12, "vector": [
+      {"x": 1, "y": 2}, {"x": 3, "y": 4, "marker": "cross", "color": "red", "text": "t"},
+      {"x": 5, "y": 6, "marker": "circle", "color": "blue"}, {"x": 7, "y": 8, "text": "no"}]})",
+  R"({"shapeid": "v", "shape": "vect", "vector": [{"x": 1, "y": 2}, {"x": "3", "y": 4},
+      {"x": 5, "y": 6}]})",
+  R"({"shapeid": "v", "shape": "vect", "vector": [{"x": 1, "y": 2}, {"x": 3, "y": 4,
+      "color": 5}, {"x": 5, "y": 6}]})",
+  R"({"shapeid": "v", "shape": "vect", "vector": [{"x": 1, "y": 2}, 5, {"x": 5, "y": 6}]})",
+  R"({"shapeid": "v", "shape": "vect", "vector": {"0": {"x": 1, "y": 1},
+      "1": {"x": 2.5, "y": true}}})",
+  R"({"shapeid": "v", "shape": "vect", "vector": 5})",
+  R"({"shapeid": "v", "shape": "vect", "vector": []})",
+  // Unknown keys are ignored, whatever value they have.
+  R"({"id": "u", "text": "a", "foo": [1, {"a": 2}], "bar": null, "baz": {"x": [true]}})",
+  // Commands, items without ids, switched modes.
+  R"({"command": "exit"})",
+  R"({"id": "c", "command": "clear", "ttl": 3})",
+  R"({"text": "no id"})",
+  R"([{"text": "no id", "ttl": 5}, {"shape": "rect", "x": 1}])",
+  R"({"id": "x", "text": "a", "shape": "rect"})",
+  R"({"id": "nothing", "x": 1, "y": 2})",
+  // Malformed json.
+  R"({"id": "e",)",
+};
+
+} // namespace
+
+int main()
+{
+    std::size_t failed = 0u;
+    for (const auto &message : kMessages)
+    {
+        const auto byDom = tryParse(parseByDom, message);
+        const auto bySax = tryParse(parseBySax, message);
+        if (byDom != bySax)
+        {
+            std::cerr << "Parsed differently: " << message << std::endl;
+            ++failed;
+        }
+    }
+    if (failed > 0u)
+    {
+        std::cerr << failed << " of " << kMessages.size() << " messages differ." << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "Json parsers are compatible." << std::endl;
+    return EXIT_SUCCESS;
+}
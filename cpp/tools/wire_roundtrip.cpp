@@ -0,0 +1,133 @@
+#include "drawables.h"
+#include "wire_decoder.hpp"
+#include "wire_format.hpp"
+
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Encodes items by wire::encoder_t and decodes them back by the overlay's decoder, as client and
+// overlay do it over the single connection. Exit code is 0 if decoded items are the same.
+
+namespace {
+
+// More distinct strings than table can keep, so the rest must be sent as literals each time.
+constexpr std::size_t kTextItems = wire::kMaxInternedStrings + 100u;
+
+std::string makeText(std::size_t index)
+{
+    return "text " + std::to_string(index);
+}
+
+std::string frameBody(const std::string &frame)
+{
+    return frame.substr(wire::kHeaderSize);
+}
+
+/// @brief Decodes @p frame made by encoder.
+draw_task::draw_items_t decodeFrame(draw_task::wire_decoder_t &decoder, const std::string &frame)
+{
+    const auto header = wire::frame_header_t::read(frame.data());
+    const auto body = frameBody(frame);
+    if (header.bodySize != body.size())
+    {
+        throw std::runtime_error("Frame's body size does not match its header.");
+    }
+    return decoder.decode(header, body);
+}
+
+void check(bool condition, std::string_view what)
+{
+    if (!condition)
+    {
+        throw std::runtime_error("Check failed: " + std::string(what));
+    }
+}
+
+void encodeTexts(wire::encoder_t &encoder)
+{
+    for (std::size_t i = 0u; i < kTextItems; ++i)
+    {
+        encoder.beginItem();
+        encoder.addString(wire::field_id_t::id, "id " + std::to_string(i));
+        encoder.addString(wire::field_id_t::text, makeText(i));
+        encoder.addString(wire::field_id_t::color, "red");
+        encoder.addNumber(wire::field_id_t::x, static_cast<int>(i));
+        encoder.addNumber(wire::field_id_t::y, -static_cast<int>(i));
+        encoder.addNumber(wire::field_id_t::ttl, 10);
+        encoder.endItem();
+    }
+}
+
+void checkTexts(const draw_task::draw_items_t &items)
+{
+    for (std::size_t i = 0u; i < kTextItems; ++i)
+    {
+        const auto it = items.find("id " + std::to_string(i));
+        check(it != items.end(), "text item is decoded");
+        const auto &item = it->second;
+        check(item.drawmode == draw_task::drawmode_t::text, "text item's mode");
+        check(item.text.text == makeText(i), "text item's text");
+        check(item.color == "red", "text item's color");
+        check(item.x == static_cast<int>(i) && item.y == -static_cast<int>(i),
+              "text item's position");
+    }
+}
+
+void encodeVector(wire::encoder_t &encoder)
+{
+    encoder.beginItem();
+    encoder.addString(wire::field_id_t::id, "vector");
+    encoder.addString(wire::field_id_t::shape, "vect");
+    encoder.addString(wire::field_id_t::color, "green");
+    encoder.addPoints({{10, 20}, {-30, 40, "red", "cross", "marker text"}, {50, -60}});
+    encoder.endItem();
+}
+
+void checkVector(const draw_task::draw_items_t &items)
+{
+    const auto it = items.find("vector");
+    check(it != items.end(), "vector is decoded");
+    const auto &shape = it->second.shape;
+    check(it->second.drawmode == draw_task::drawmode_t::shape, "vector's mode");
+    check(shape.shape == "vect" && it->second.color == "green", "vector's strings");
+    const std::vector<draw_task::vector_point_t> points{{10, 20, 0}, {-30, 40, 1}, {50, -60, 0}};
+    check(shape.points == points, "vector's points");
+    const std::vector<draw_task::vector_marker_t> markers{{"red", "cross", "marker text"}};
+    check(shape.markers == markers, "vector's markers");
+}
+
+} // namespace
+
+int main()
+{
+    try
+    {
+        wire::encoder_t encoder;
+        draw_task::wire_decoder_t decoder;
+
+        // First frame fills the table of the strings, second one references it and repeats
+        // strings which did not fit into it.
+        for (int frame = 0; frame < 2; ++frame)
+        {
+            encodeTexts(encoder);
+            encodeVector(encoder);
+            const auto items = decodeFrame(decoder, encoder.takeFrame());
+            check(items.size() == kTextItems + 1u, "count of the items");
+            checkTexts(items);
+            checkVector(items);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "Wire format round trip is OK." << std::endl;
+    return EXIT_SUCCESS;
+}
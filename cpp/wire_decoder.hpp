@@ -0,0 +1,200 @@
+#pragma once
+
+#include "drawables.h"
+#include "wire_format.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace draw_task {
+
+/// @brief Decodes binary frames of the single connection into draw items.
+/// @details Keeps table of the strings sent by client, so it must live as long as connection.
+/// Items are built by the same rules as json ones.
+class wire_decoder_t
+{
+  public:
+    /// @throws std::invalid_argument if frame is malformed. Table of the strings cannot be
+    /// trusted after that, so connection must be dropped.
+    draw_items_t decode(const wire::frame_header_t &header, std::string_view body)
+    {
+        if (header.version != wire::kVersion || header.flags != 0u)
+        {
+            throw std::invalid_argument("Binary message: unsupported version.");
+        }
+
+        draw_items_t result;
+        drawitem_builder_t builder({});
+        wire::reader_t reader(body);
+        for (std::size_t i = 0u; i < header.items; ++i)
+        {
+            builder.begin();
+            decodeItem(reader, builder);
+            builder.finish(result);
+        }
+        if (!reader.atEnd())
+        {
+            throw std::invalid_argument("Binary message: garbage after the items.");
+        }
+        return result;
+    }
+
+  private:
+    std::vector<std::string> strings;
+
+    static item_field_t toItemField(wire::field_id_t field)
+    {
+        using wire::field_id_t;
+        switch (field)
+        {
+            case field_id_t::x:
+                return item_field_t::x;
+            case field_id_t::y:
+                return item_field_t::y;
+            case field_id_t::w:
+                return item_field_t::w;
+            case field_id_t::h:
+                return item_field_t::h;
+            case field_id_t::color:
+                return item_field_t::color;
+            case field_id_t::text:
+                return item_field_t::text;
+            case field_id_t::svg:
+                return item_field_t::svg;
+            case field_id_t::css:
+                return item_field_t::css;
+            case field_id_t::size:
+                return item_field_t::size;
+            case field_id_t::font_size:
+                return item_field_t::font_size;
+            case field_id_t::font_file:
+                return item_field_t::font_file;
+            case field_id_t::vector_font_size:
+                return item_field_t::vector_font_size;
+            case field_id_t::shape:
+                return item_field_t::shape;
+            case field_id_t::fill:
+                return item_field_t::fill;
+            case field_id_t::vector:
+                return item_field_t::vector;
+            case field_id_t::ttl:
+                return item_field_t::ttl;
+            case field_id_t::id:
+                return item_field_t::id;
+            case field_id_t::command:
+                return item_field_t::command;
+            default:
+                return item_field_t::unknown;
+        }
+    }
+
+    void decodeItem(wire::reader_t &reader, drawitem_builder_t &builder)
+    {
+        while (true)
+        {
+            const auto tag = reader.readVarint();
+            if (tag == 0u)
+            {
+                return;
+            }
+            const auto type = static_cast<wire::value_type_t>(tag & 3u);
+            const auto fieldId = tag >> 2u;
+            const auto field = fieldId <= std::numeric_limits<std::uint8_t>::max()
+                                 ? toItemField(static_cast<wire::field_id_t>(fieldId))
+                                 : item_field_t::unknown;
+            if (field != item_field_t::unknown
+                && wire::valueTypeOf(static_cast<wire::field_id_t>(fieldId)) != type)
+            {
+                throw std::invalid_argument("Binary message: wrong value type of the field.");
+            }
+            // Values are read even if those are ignored, strings must be interned anyway.
+            const bool apply = field != item_field_t::unknown && !builder.isBroken();
+            switch (type)
+            {
+                case wire::value_type_t::number:
+                {
+                    const auto value = static_cast<int>(reader.readNumber());
+                    if (apply)
+                    {
+                        builder.setNumber(field, value);
+                    }
+                    break;
+                }
+                case wire::value_type_t::string:
+                {
+                    auto value = readString(reader);
+                    if (apply)
+                    {
+                        builder.setString(field, std::move(value));
+                    }
+                    break;
+                }
+                case wire::value_type_t::points:
+                    readPoints(reader, apply ? &builder : nullptr);
+                    break;
+                default:
+                    throw std::invalid_argument("Binary message: unknown value type.");
+            }
+        }
+    }
+
+    std::string readString(wire::reader_t &reader)
+    {
+        const auto ref = reader.readVarint();
+        if (ref > 0u)
+        {
+            if (ref > strings.size())
+            {
+                throw std::invalid_argument("Binary message: unknown string reference.");
+            }
+            return strings[static_cast<std::size_t>(ref - 1u)];
+        }
+        std::string value(reader.readBytes(reader.readVarint()));
+        if (strings.size() < wire::kMaxInternedStrings)
+        {
+            strings.push_back(value);
+        }
+        return value;
+    }
+
+    /// @param builder - receives points, nullptr if points are skipped.
+    void readPoints(wire::reader_t &reader, drawitem_builder_t *builder)
+    {
+        const auto count = reader.readVarint();
+        if (builder)
+        {
+            builder->startPoints();
+        }
+        // Unsigned, so garbage deltas wrap instead of overflow.
+        std::uint64_t x = 0u;
+        std::uint64_t y = 0u;
+        for (std::uint64_t i = 0u; i < count; ++i)
+        {
+            x += static_cast<std::uint64_t>(reader.readNumber());
+            y += static_cast<std::uint64_t>(reader.readNumber());
+            vector_marker_t marker;
+            const auto flag = reader.readVarint();
+            if (flag > 1u)
+            {
+                throw std::invalid_argument("Binary message: unknown point flag.");
+            }
+            if (flag == 1u)
+            {
+                marker.color = readString(reader);
+                marker.type = readString(reader);
+                marker.text = readString(reader);
+            }
+            if (builder)
+            {
+                builder->addPoint(static_cast<int>(x), static_cast<int>(y), std::move(marker));
+            }
+        }
+    }
+};
+} // namespace draw_task
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// @brief Compact binary alternative of the json messages. It has no dependencies except std, so
+/// clients can include it to encode messages.
+/// @details Client sends kMagic once right after connect, then frames follow. Frame is fixed
+/// header and body of the items.
+/// Header (little endian): version u8, flags u8 (must be 0), items count u16, body size u32.
+/// Item is list of the fields ended by zero tag. Tag is varint (field id << 2 | value type), so
+/// unknown fields of the newer clients are skipped by type. Values are:
+/// - number: zigzag varint;
+/// - string: varint reference into connection-wide table of strings, 1 is the first string. 0
+///   means literal follows (varint size, bytes), it is appended to the table while table is not
+///   full;
+/// - points: varint count, then per point zigzag deltas of x and y from the previous point and
+///   varint flag, if flag is 1 then 3 strings follow: color, marker type, text.
+namespace wire {
+
+// First byte of the connection. Json messages start by digit, so any other byte is fine.
+constexpr std::uint8_t kMagic = 0xEDu;
+constexpr std::uint8_t kVersion = 1u;
+constexpr std::size_t kHeaderSize = 8u;
+// FYI: Configurable value, encoder and decoder must use the same.
+constexpr std::size_t kMaxInternedStrings = 4096u;
+
+enum class value_type_t : std::uint8_t {
+    number = 0,
+    string = 1,
+    points = 2,
+};
+
+/// @brief Ids of the fields, those are part of the protocol and never reused.
+enum class field_id_t : std::uint8_t {
+    end = 0,
+    x = 1,
+    y = 2,
+    w = 3,
+    h = 4,
+    color = 5,
+    text = 6,
+    svg = 7,
+    css = 8,
+    size = 9,
+    font_size = 10,
+    font_file = 11,
+    vector_font_size = 12,
+    shape = 13,
+    fill = 14,
+    vector = 15,
+    ttl = 16,
+    id = 17,
+    command = 18,
+};
+
+/// @returns type of the value of the known field.
+constexpr value_type_t valueTypeOf(field_id_t field)
+{
+    switch (field)
+    {
+        case field_id_t::x:
+        case field_id_t::y:
+        case field_id_t::w:
+        case field_id_t::h:
+        case field_id_t::font_size:
+        case field_id_t::vector_font_size:
+        case field_id_t::ttl:
+            return value_type_t::number;
+        case field_id_t::vector:
+            return value_type_t::points;
+        default:
+            return value_type_t::string;
+    }
+}
+
+struct frame_header_t
+{
+    std::uint8_t version{kVersion};
+    std::uint8_t flags{0u};
+    std::uint16_t items{0u};
+    std::uint32_t bodySize{0u};
+
+    /// @param src - kHeaderSize bytes.
+    static frame_header_t read(const char *src)
+    {
+        const auto byte = [src](std::size_t index) -> std::uint32_t {
+            return static_cast<unsigned char>(src[index]);
+        };
+        frame_header_t header;
+        header.version = static_cast<std::uint8_t>(byte(0));
+        header.flags = static_cast<std::uint8_t>(byte(1));
+        header.items = static_cast<std::uint16_t>(byte(2) | (byte(3) << 8u));
+        header.bodySize = byte(4) | (byte(5) << 8u) | (byte(6) << 16u) | (byte(7) << 24u);
+        return header;
+    }
+
+    void write(std::string &out) const
+    {
+        out.push_back(static_cast<char>(version));
+        out.push_back(static_cast<char>(flags));
+        for (unsigned shift = 0u; shift < 16u; shift += 8u)
+        {
+            out.push_back(static_cast<char>((items >> shift) & 0xFFu));
+        }
+        for (unsigned shift = 0u; shift < 32u; shift += 8u)
+        {
+            out.push_back(static_cast<char>((bodySize >> shift) & 0xFFu));
+        }
+    }
+};
+
+/// @brief Point of the "vector" shape, marker is drawn if color is set.
+struct point_t
+{
+    int x{0};
+    int y{0};
+    std::string_view color{};
+    std::string_view marker{};
+    std::string_view text{};
+};
+
+constexpr std::uint64_t zigzag(std::int64_t value)
+{
+    return (static_cast<std::uint64_t>(value) << 1u) ^ static_cast<std::uint64_t>(value >> 63);
+}
+
+constexpr std::int64_t unzigzag(std::uint64_t value)
+{
+    return static_cast<std::int64_t>(value >> 1u) ^ -static_cast<std::int64_t>(value & 1u);
+}
+
+inline void writeVarint(std::string &out, std::uint64_t value)
+{
+    while (value >= 0x80u)
+    {
+        out.push_back(static_cast<char>((value & 0x7Fu) | 0x80u));
+        value >>= 7u;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+/// @brief Reads values from the frame's body.
+/// @throws std::invalid_argument if body ends unexpectedly or value is malformed.
+class reader_t
+{
+  public:
+    explicit reader_t(std::string_view data) :
+        data(data)
+    {
+    }
+
+    [[nodiscard]]
+    bool atEnd() const
+    {
+        return pos == data.size();
+    }
+
+    std::uint64_t readVarint()
+    {
+        std::uint64_t value = 0u;
+        for (unsigned shift = 0u; shift < 64u; shift += 7u)
+        {
+            if (atEnd())
+            {
+                throw std::invalid_argument("Binary message: varint is truncated.");
+            }
+            const auto byte = static_cast<unsigned char>(data[pos++]);
+            value |= static_cast<std::uint64_t>(byte & 0x7Fu) << shift;
+            if ((byte & 0x80u) == 0u)
+            {
+                return value;
+            }
+        }
+        throw std::invalid_argument("Binary message: varint is too long.");
+    }
+
+    std::int64_t readNumber()
+    {
+        return unzigzag(readVarint());
+    }
+
+    std::string_view readBytes(std::uint64_t size)
+    {
+        if (size > data.size() - pos)
+        {
+            throw std::invalid_argument("Binary message: string is truncated.");
+        }
+        const auto bytes = data.substr(pos, static_cast<std::size_t>(size));
+        pos += bytes.size();
+        return bytes;
+    }
+
+  private:
+    std::string_view data;
+    std::size_t pos{0u};
+};
+
+/// @brief Builds binary frames. Single encoder must be used per connection, because strings
+/// sent once are referenced by index later.
+/// @details Usage: send preamble() once, then for each message call beginItem(), add...(),
+/// endItem() per item and send takeFrame().
+class encoder_t
+{
+  public:
+    encoder_t() = default;
+    // Table of the strings refers to own storage, so copy would refer to the original.
+    encoder_t(const encoder_t &) = delete;
+    encoder_t &operator=(const encoder_t &) = delete;
+    encoder_t(encoder_t &&) = default;
+    encoder_t &operator=(encoder_t &&) = default;
+    ~encoder_t() = default;
+
+    /// @returns bytes which client sends once right after connect.
+    static std::string preamble()
+    {
+        return std::string(1u, static_cast<char>(kMagic));
+    }
+
+    void beginItem()
+    {
+        if (items == std::numeric_limits<std::uint16_t>::max())
+        {
+            throw std::length_error("Too many items in the single frame.");
+        }
+    }
+
+    void addNumber(field_id_t field, int value)
+    {
+        writeTag(field, value_type_t::number);
+        writeVarint(body, zigzag(value));
+    }
+
+    void addString(field_id_t field, std::string_view value)
+    {
+        writeTag(field, value_type_t::string);
+        writeString(value);
+    }
+
+    void addPoints(const std::vector<point_t> &points)
+    {
+        writeTag(field_id_t::vector, value_type_t::points);
+        writeVarint(body, points.size());
+        std::int64_t prevX = 0;
+        std::int64_t prevY = 0;
+        for (const auto &point : points)
+        {
+            writeVarint(body, zigzag(point.x - prevX));
+            writeVarint(body, zigzag(point.y - prevY));
+            prevX = point.x;
+            prevY = point.y;
+            const bool hasMarker =
+              !point.color.empty() || !point.marker.empty() || !point.text.empty();
+            writeVarint(body, hasMarker ? 1u : 0u);
+            if (hasMarker)
+            {
+                writeString(point.color);
+                writeString(point.marker);
+                writeString(point.text);
+            }
+        }
+    }
+
+    void endItem()
+    {
+        writeVarint(body, static_cast<std::uint64_t>(field_id_t::end));
+        ++items;
+    }
+
+    /// @returns complete frame of the items added since previous call.
+    std::string takeFrame()
+    {
+        if (body.size() > std::numeric_limits<std::uint32_t>::max())
+        {
+            throw std::length_error("Frame body is too big.");
+        }
+        frame_header_t header;
+        header.items = items;
+        header.bodySize = static_cast<std::uint32_t>(body.size());
+
+        std::string frame;
+        frame.reserve(kHeaderSize + body.size());
+        header.write(frame);
+        frame += body;
+        body.clear();
+        items = 0u;
+        return frame;
+    }
+
+  private:
+    std::string body;
+    std::uint16_t items{0u};
+    // Strings sent to the connection, deque keeps their addresses stable.
+    std::deque<std::string> internedStrings;
+    // String to its 1-based index into the table of the connection, views are into
+    // internedStrings, so lookup by string_view does not allocate.
+    std::unordered_map<std::string_view, std::uint64_t> interned;
+
+    void writeTag(field_id_t field, value_type_t type)
+    {
+        if (valueTypeOf(field) != type || field == field_id_t::end)
+        {
+            throw std::invalid_argument("Value type does not match the field.");
+        }
+        writeVarint(body, (static_cast<std::uint64_t>(field) << 2u)
+                            | static_cast<std::uint64_t>(type));
+    }
+
+    void writeString(std::string_view value)
+    {
+        const auto it = interned.find(value);
+        if (it != interned.end())
+        {
+            writeVarint(body, it->second);
+            return;
+        }
+        writeVarint(body, 0u);
+        writeVarint(body, value.size());
+        body.append(value);
+        if (interned.size() < kMaxInternedStrings)
+        {
+            internedStrings.emplace_back(value);
+            interned.emplace(internedStrings.back(), interned.size() + 1u);
+        }
+    }
+};
+} // namespace wire
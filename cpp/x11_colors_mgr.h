@@ -8,10 +8,13 @@
 #include <X11/extensions/Xrender.h>
 
 #include <algorithm>
+#include <cctype>
 #include <cstdint>
 #include <cstdio>
+#include <iterator>
 #include <limits>
 #include <map>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <tuple>
@@ -56,6 +59,19 @@ class MyXOverlayColorMap
             return {upScale(red), upScale(green), upScale(blue), upScale(alpha)};
         }
 
+        /// @returns an XRenderColor object with components premultiplied by alpha, as XRender
+        /// expects for the fills.
+        [[nodiscard]]
+        XRenderColor toPremultipliedRenderColor() const
+        {
+            const auto premultiply = [this](std::uint8_t color) -> std::uint8_t {
+                return static_cast<std::uint8_t>((static_cast<std::uint32_t>(color) * alpha)
+                                                 / 0xFFu);
+            };
+            return TRGBAColor{premultiply(red), premultiply(green), premultiply(blue), alpha}
+              .toRenderColor();
+        }
+
         /// @returns integer color converted to double in range [0;1].
         template <typename T>
         static constexpr double ConvertColorComponent(T val)
@@ -138,35 +154,51 @@ class MyXOverlayColorMap
     /// to be a hex code.  Otherwise, it is looked up in a map of known colors.
     /// @return A TRGBAColor object representing the decoded color.
     static TRGBAColor decodeRGBAColor(const std::string &name)
+    {
+        return tryDecodeRGBAColor(name).value_or(TRGBAColor{0xFF, 0xFF, 0xFF, kAlpha});
+    }
+
+    /// @brief Same as decodeRGBAColor() but does not substitute unknown names.
+    /// @details Colors are read as CSS does, same as SVG drawing of the items: opaque by default,
+    /// 8 digits hex code is #RRGGBBAA.
+    /// @returns std::nullopt if @p name is not a hex code nor known color name.
+    static std::optional<TRGBAColor> tryDecodeRGBAColor(const std::string &name)
     {
         // todo: add more colors here which can be recognized by string-name
         const static std::map<std::string, TRGBAColor> named_colors = {
           // Those 2 colors used to clear the frame
           {"transparent", {0, 0, 0, 0}},      {"solid_white", {255, 255, 255, 255}},
 
-          {"white", {255, 255, 255, kAlpha}}, {"black", {0, 0, 0, kAlpha}},
-          {"blue", {0, 0, 255, kAlpha}},      {"yellow", {255, 255, 0, kAlpha}},
-          {"green", {0, 255, 0, kAlpha}},     {"red", {255, 0, 0, kAlpha}},
+          {"white", {255, 255, 255, 255}},    {"black", {0, 0, 0, 255}},
+          {"blue", {0, 0, 255, 255}},         {"yellow", {255, 255, 0, 255}},
+          {"green", {0, 128, 0, 255}},        {"red", {255, 0, 0, 255}},
         };
 
-        TRGBAColor curr{0xFF, 0xFF, 0xFF, kAlpha};
+        std::optional<TRGBAColor> curr{std::nullopt};
         const auto nameLen = name.length();
         const bool nl7 = nameLen == 7;
         const bool nl9 = nameLen == 9;
         if ((nl7 || nl9) && name.rfind /*Last occurence*/ ('#', 0) == 0)
         {
+            const bool isHex = std::all_of(std::next(name.begin()), name.end(), [](char c) {
+                return std::isxdigit(static_cast<unsigned char>(c)) != 0;
+            });
+            if (!isHex)
+            {
+                return std::nullopt;
+            }
             // direct hex color code
             if (nl7)
             {
                 unsigned int r = 0, g = 0, b = 0;
                 sscanf(name.c_str(), "#%02x%02x%02x", &r, &g, &b);
                 curr = TRGBAColor{static_cast<uint8_t>(r), static_cast<uint8_t>(g),
-                                  static_cast<uint8_t>(b), static_cast<uint8_t>(kAlpha)};
+                                  static_cast<uint8_t>(b), 0xFF};
             }
             if (nl9)
             {
-                unsigned int a = 0, r = 0, g = 0, b = 0;
-                sscanf(name.c_str(), "#%02x%02x%02x%02x", &a, &r, &g, &b);
+                unsigned int r = 0, g = 0, b = 0, a = 0;
+                sscanf(name.c_str(), "#%02x%02x%02x%02x", &r, &g, &b, &a);
                 curr = TRGBAColor{static_cast<uint8_t>(r), static_cast<uint8_t>(g),
                                   static_cast<uint8_t>(b), static_cast<uint8_t>(a)};
             }
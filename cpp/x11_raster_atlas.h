@@ -0,0 +1,252 @@
+#pragma once
+
+#include "cm_ctors.h"
+#include "managed_id.hpp"
+#include "opaque_ptr.h"
+
+#include <X11/X.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/Xrender.h>
+
+#include <algorithm>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <vector>
+
+/// @brief Packs small rasters into few big shared ARGB pixmaps (pages) by shelves.
+/// @details Each page is split into horizontal shelves, each shelf keeps sorted list of free spans.
+/// Released spans are merged with neighbours, fully free top shelves and pages are dropped, so
+/// space is compacted back without moving live rasters.
+class MyXRasterAtlas
+{
+  private:
+    struct TPage;
+
+  public:
+    /// @brief Place of single raster inside the page, it is released on destruction.
+    class TSlot
+    {
+      public:
+        NO_COPYMOVE(TSlot);
+        TSlot() = delete;
+
+        TSlot(MyXRasterAtlas &owner, TPage &page, std::size_t shelf, int x, int y, int width) :
+            owner(owner),
+            page(page),
+            shelf(shelf),
+            x(x),
+            y(y),
+            width(width)
+        {
+        }
+
+        ~TSlot()
+        {
+            owner.release(page, shelf, x, width);
+        }
+
+        [[nodiscard]]
+        Pixmap pixmap() const
+        {
+            return page.pixmap;
+        }
+
+        [[nodiscard]]
+        Picture picture() const
+        {
+            return page.picture;
+        }
+
+      private:
+        MyXRasterAtlas &owner;
+        TPage &page;
+        std::size_t shelf;
+
+      public:
+        const int x;
+        const int y;
+        const int width;
+    };
+    using TSlotPtr = std::shared_ptr<TSlot>;
+
+    NO_COPYMOVE(MyXRasterAtlas);
+    MyXRasterAtlas() = delete;
+
+    MyXRasterAtlas(const opaque_ptr<Display> &g_display, Drawable drawable) :
+        g_display(g_display),
+        drawable(drawable),
+        argbFormat(XRenderFindStandardFormat(g_display, PictStandardARGB32))
+    {
+    }
+
+    ~MyXRasterAtlas() = default;
+
+    [[nodiscard]]
+    static bool isFitting(int width, int height)
+    {
+        return width > 0 && height > 0 && width <= kMaxItemWidth && height <= kMaxItemHeight;
+    }
+
+    /// @returns place for @p width x @p height raster or nullptr if it is too big for atlas.
+    TSlotPtr allocate(int width, int height)
+    {
+        if (!isFitting(width, height))
+        {
+            return nullptr;
+        }
+        const int shelfHeight = roundUp(height, kShelfHeightStep);
+        for (auto &page : pages)
+        {
+            if (auto slot = allocateOnPage(page, width, shelfHeight))
+            {
+                return slot;
+            }
+        }
+        auto *page = addPage();
+        return page ? allocateOnPage(*page, width, shelfHeight) : nullptr;
+    }
+
+  private:
+    // FYI: Configurable values.
+    static constexpr int kPageSize = 1024;
+    static constexpr int kMaxItemWidth = 512;
+    static constexpr int kMaxItemHeight = 128;
+    static constexpr int kShelfHeightStep = 8;
+
+    struct TSpan
+    {
+        int x;
+        int width;
+    };
+
+    struct TShelf
+    {
+        int y;
+        int height;
+        // Sorted by x, neighbours are never adjacent.
+        std::vector<TSpan> freeSpans;
+
+        [[nodiscard]]
+        bool isFree() const
+        {
+            return freeSpans.size() == 1 && freeSpans.front().width == kPageSize;
+        }
+    };
+
+    struct TPage
+    {
+        TManagedId<Pixmap, None> pixmap;
+        TManagedId<Picture, None> picture;
+        std::vector<TShelf> shelves;
+        int nextShelfY{0};
+    };
+
+    const opaque_ptr<Display> &g_display;
+    const Drawable drawable;
+    XRenderPictFormat *argbFormat;
+    // List keeps pages in place, slots refer them.
+    std::list<TPage> pages;
+
+    static int roundUp(int value, int step)
+    {
+        return ((value + step - 1) / step) * step;
+    }
+
+    TPage *addPage()
+    {
+        TPage page;
+        page.pixmap = TManagedId<Pixmap, None>{
+          XCreatePixmap(g_display, drawable, kPageSize, kPageSize, argbFormat->depth),
+          [this](Pixmap id) {
+              XFreePixmap(g_display, id);
+          }};
+        if (!page.pixmap.IsInitialized())
+        {
+            return nullptr;
+        }
+        page.picture = TManagedId<Picture, None>{
+          XRenderCreatePicture(g_display, page.pixmap, argbFormat, 0, nullptr), [this](Picture id) {
+              XRenderFreePicture(g_display, id);
+          }};
+        pages.emplace_back(std::move(page));
+        return &pages.back();
+    }
+
+    TSlotPtr allocateOnPage(TPage &page, int width, int shelfHeight)
+    {
+        // Shelves much higher than needed waste space, new shelf is better then.
+        for (std::size_t i = 0; i < page.shelves.size(); ++i)
+        {
+            auto &shelf = page.shelves[i];
+            if (shelf.height < shelfHeight || shelf.height > shelfHeight * 2)
+            {
+                continue;
+            }
+            const auto span = std::find_if(shelf.freeSpans.begin(), shelf.freeSpans.end(),
+                                           [width](const TSpan &span) {
+                                               return span.width >= width;
+                                           });
+            if (span != shelf.freeSpans.end())
+            {
+                return takeSpan(page, i, span, width);
+            }
+        }
+
+        if (page.nextShelfY + shelfHeight > kPageSize)
+        {
+            return nullptr;
+        }
+        page.shelves.push_back({page.nextShelfY, shelfHeight, {{0, kPageSize}}});
+        page.nextShelfY += shelfHeight;
+        return takeSpan(page, page.shelves.size() - 1, page.shelves.back().freeSpans.begin(),
+                        width);
+    }
+
+    TSlotPtr takeSpan(TPage &page, std::size_t shelfIndex, std::vector<TSpan>::iterator span,
+                      int width)
+    {
+        auto &shelf = page.shelves[shelfIndex];
+        const int x = span->x;
+        span->x += width;
+        span->width -= width;
+        if (span->width == 0)
+        {
+            shelf.freeSpans.erase(span);
+        }
+        return std::make_shared<TSlot>(*this, page, shelfIndex, x, shelf.y, width);
+    }
+
+    void release(TPage &page, std::size_t shelfIndex, int x, int width)
+    {
+        auto &spans = page.shelves[shelfIndex].freeSpans;
+        auto next = std::lower_bound(spans.begin(), spans.end(), x, [](const TSpan &span, int x) {
+            return span.x < x;
+        });
+        next = spans.insert(next, {x, width});
+
+        // Merging with neighbours, so free space does not fragment.
+        if (std::next(next) != spans.end() && next->x + next->width == std::next(next)->x)
+        {
+            next->width += std::next(next)->width;
+            spans.erase(std::next(next));
+        }
+        if (next != spans.begin() && std::prev(next)->x + std::prev(next)->width == next->x)
+        {
+            std::prev(next)->width += next->width;
+            spans.erase(next);
+        }
+
+        while (!page.shelves.empty() && page.shelves.back().isFree())
+        {
+            page.nextShelfY = page.shelves.back().y;
+            page.shelves.pop_back();
+        }
+        if (page.shelves.empty() && pages.size() > 1)
+        {
+            pages.remove_if([&page](const TPage &existing) {
+                return &existing == &page;
+            });
+        }
+    }
+};
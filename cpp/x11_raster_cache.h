@@ -0,0 +1,136 @@
+#pragma once
+
+#include "cm_ctors.h"
+#include "drawables.h"
+#include "lru_cache.hpp"
+#include "managed_id.hpp"
+#include "x11_raster_atlas.h"
+
+#include <X11/X.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+/// @brief Rasterized SVG uploaded to X server, ready to be composited as is.
+/// @note Small rasters are placed into shared atlas, big ones own the pixmap and its picture for
+/// whole lifetime.
+struct TXRaster
+{
+    TManagedId<Pixmap, None> pixmap;
+    TManagedId<Picture, None> picture;
+    MyXRasterAtlas::TSlotPtr slot{nullptr};
+    int width{0};
+    int height{0};
+
+    [[nodiscard]]
+    bool isValid() const
+    {
+        return picture.IsInitialized() || slot;
+    }
+
+    [[nodiscard]]
+    Picture sourcePicture() const
+    {
+        return slot ? slot->picture() : static_cast<Picture>(picture);
+    }
+
+    [[nodiscard]]
+    int sourceX() const
+    {
+        return slot ? slot->x : 0;
+    }
+
+    [[nodiscard]]
+    int sourceY() const
+    {
+        return slot ? slot->y : 0;
+    }
+
+    [[nodiscard]]
+    std::size_t memoryUsed() const
+    {
+        return static_cast<std::size_t>(width) * static_cast<std::size_t>(height)
+               * sizeof(std::uint32_t);
+    }
+};
+
+/// @brief Keeps rasterized SVGs by content, so identical content is rasterized once, even if it
+/// was sent by different ids or resent.
+/// @details Least recently used rasters are dropped once memory budget is exceeded. Handed out
+/// rasters are refcounted, so dropped raster lives while some item still draws it.
+class MyXRasterCache
+{
+  public:
+    /// @brief Hash of the SVG content, including style and font.
+    struct TSvgHash
+    {
+        std::size_t operator()(const draw_task::drawitem_t::drawsvg_t &svg) const
+        {
+            const std::hash<std::string> hasher;
+            std::size_t seed = hasher(svg.svg);
+            for (const auto *part : {&svg.css, &svg.fontFile})
+            {
+                seed ^= hasher(*part) + 0x9e3779b9u + (seed << 6u) + (seed >> 2u); // NOLINT
+            }
+            return seed;
+        }
+    };
+
+    using TRasterPtr = std::shared_ptr<const TXRaster>;
+    using TRasterizer = std::function<TXRaster()>;
+
+    NO_COPYMOVE(MyXRasterCache);
+    MyXRasterCache() = delete;
+
+    explicit MyXRasterCache(std::size_t memoryBudget) :
+        rasters(memoryBudget)
+    {
+    }
+
+    ~MyXRasterCache() = default;
+
+    /// @returns cached raster of the @p svg or nullptr.
+    TRasterPtr find(const draw_task::drawitem_t::drawsvg_t &svg)
+    {
+        const auto *cached = rasters.find(svg);
+        return cached ? *cached : nullptr;
+    }
+
+    /// @returns cached raster of the @p svg or calls @p rasterize and caches its result.
+    /// @note Failed rasterization is not cached, nullptr is returned.
+    TRasterPtr getOrRasterize(const draw_task::drawitem_t::drawsvg_t &svg,
+                              const TRasterizer &rasterize)
+    {
+        if (auto cached = find(svg))
+        {
+            return cached;
+        }
+
+        auto raster = std::make_shared<const TXRaster>(rasterize());
+        if (!raster->isValid())
+        {
+            return nullptr;
+        }
+        return rasters.insert(svg, std::move(raster));
+    }
+
+    void clear()
+    {
+        rasters.clear();
+    }
+
+  private:
+    struct TRasterCost
+    {
+        std::size_t operator()(const TRasterPtr &raster) const
+        {
+            return raster->memoryUsed();
+        }
+    };
+
+    utility::LruCache<draw_task::drawitem_t::drawsvg_t, TRasterPtr, TSvgHash, TRasterCost> rasters;
+};
@@ -0,0 +1,250 @@
+#pragma once
+
+#include "cm_ctors.h"
+#include "drawables.h"
+#include "opaque_ptr.h"
+
+#include <X11/X.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/Xrender.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// @brief Draws "shape" drawables (rectangles, vectors and markers) directly by XRender
+/// antialiased triangles, so no SVG string is built and parsed per update.
+/// @details Geometry matches the SVG produced by SvgBuilder: strokes are centered on the given
+/// coordinates and have width of the drawshape_t::kStrokeWidth. Texts of the markers are not drawn
+/// here, those are returned to the caller as text drawables.
+class MyXShapeRenderer
+{
+  public:
+    /// @brief Shape converted into triangles, ready to be composited.
+    struct TPreparedShape
+    {
+        /// @brief Triangles of the same color.
+        struct TColoredTriangles
+        {
+            Picture source{None};
+            std::vector<XTriangle> triangles;
+        };
+
+        std::vector<TColoredTriangles> strokes;
+        std::vector<draw_task::drawitem_t> markerTexts;
+        // Bounds of the strokes only, marker texts are not included.
+        draw_task::screen_rect_t bounds;
+    };
+
+    /// @returns solid fill picture of the color or None if color is not recognized.
+    using TColorSource = std::function<Picture(const std::string &)>;
+
+    NO_COPYMOVE(MyXShapeRenderer);
+    MyXShapeRenderer() = delete;
+    ~MyXShapeRenderer() = default;
+
+    MyXShapeRenderer(const opaque_ptr<Display> &g_display, TColorSource colorSource) :
+        g_display(g_display),
+        maskFormat(XRenderFindStandardFormat(g_display, PictStandardA8)),
+        colorSource(std::move(colorSource))
+    {
+    }
+
+    /// @returns triangles of the @p drawitem or std::nullopt if it cannot be drawn natively.
+    [[nodiscard]]
+    std::optional<TPreparedShape> prepare(const draw_task::drawitem_t &drawitem) const
+    {
+        using draw_task::TMarkerInVectorInShape;
+        constexpr double kHalfSize = TMarkerInVectorInShape::kHalfSize;
+
+        TPreparedShape result;
+        bool colorsOk = true;
+        const auto trianglesOf = [&](const std::string &color) -> std::vector<XTriangle> * {
+            const auto source = colorSource(color);
+            if (source == None)
+            {
+                colorsOk = false;
+                return nullptr;
+            }
+            auto it = std::find_if(result.strokes.begin(), result.strokes.end(),
+                                   [source](const auto &stroke) {
+                                       return stroke.source == source;
+                                   });
+            if (it == result.strokes.end())
+            {
+                result.strokes.push_back({source, {}});
+                it = std::prev(result.strokes.end());
+            }
+            return &it->triangles;
+        };
+
+        const auto drawLine = [&](int x1, int y1, int x2, int y2) {
+            if (auto *triangles = trianglesOf(drawitem.color))
+            {
+                addLine(*triangles, x1, y1, x2, y2);
+            }
+        };
+
+        const auto drawMarker = [&](const TMarkerInVectorInShape &marker,
+                                    font_size::FontPixelSize vector_font_size) {
+            if (marker.IsCircle() || marker.IsCross())
+            {
+                if (auto *triangles = trianglesOf(marker.color))
+                {
+                    if (marker.IsCircle())
+                    {
+                        addCircle(*triangles, marker.x, marker.y, kHalfSize);
+                    }
+                    if (marker.IsCross())
+                    {
+                        addLine(*triangles, marker.x - kHalfSize, marker.y - kHalfSize,
+                                marker.x + kHalfSize, marker.y + kHalfSize);
+                        addLine(*triangles, marker.x - kHalfSize, marker.y + kHalfSize,
+                                marker.x + kHalfSize, marker.y - kHalfSize);
+                    }
+                }
+            }
+            if (marker.HasText())
+            {
+                result.markerTexts.emplace_back(marker.MakeTextTask(vector_font_size));
+            }
+        };
+
+        const bool had_vec = draw_task::ForEachVectorPointsPair(drawitem, drawLine, drawMarker);
+        if (!had_vec && drawitem.shape.shape == "rect")
+        {
+            if (auto *triangles = trianglesOf(drawitem.color))
+            {
+                addRectangle(*triangles, drawitem.x, drawitem.y, drawitem.shape.w,
+                             drawitem.shape.h);
+            }
+        }
+
+        if (!colorsOk)
+        {
+            return std::nullopt;
+        }
+        result.bounds = boundsOf(result.strokes);
+        return result;
+    }
+
+    /// @brief Composites prepared @p shape into @p destination.
+    void draw(const TPreparedShape &shape, Picture destination) const
+    {
+        for (const auto &stroke : shape.strokes)
+        {
+            XRenderCompositeTriangles(g_display, PictOpOver, stroke.source, destination,
+                                      maskFormat, 0, 0, stroke.triangles.data(),
+                                      static_cast<int>(stroke.triangles.size()));
+        }
+    }
+
+  private:
+    static constexpr double kHalfStroke =
+      draw_task::drawitem_t::drawshape_t::kStrokeWidth / 2.0;
+    // Circle markers are small, so that is smooth enough.
+    static constexpr int kCircleSegments = 24;
+
+    const opaque_ptr<Display> &g_display;
+    XRenderPictFormat *maskFormat;
+    TColorSource colorSource;
+
+    static XPointFixed toFixed(double x, double y)
+    {
+        return {XDoubleToFixed(x), XDoubleToFixed(y)};
+    }
+
+    /// @brief Adds quadrangle given by corners in drawing order as 2 triangles.
+    static void addQuad(std::vector<XTriangle> &triangles, const XPointFixed &p1,
+                        const XPointFixed &p2, const XPointFixed &p3, const XPointFixed &p4)
+    {
+        triangles.push_back({p1, p2, p3});
+        triangles.push_back({p1, p3, p4});
+    }
+
+    /// @brief Adds line with butt caps, same as SVG <line>.
+    static void addLine(std::vector<XTriangle> &triangles, double x1, double y1, double x2,
+                        double y2)
+    {
+        const double length = std::hypot(x2 - x1, y2 - y1);
+        if (length <= 0.0)
+        {
+            return;
+        }
+        const double nx = -(y2 - y1) / length * kHalfStroke;
+        const double ny = (x2 - x1) / length * kHalfStroke;
+        addQuad(triangles, toFixed(x1 + nx, y1 + ny), toFixed(x2 + nx, y2 + ny),
+                toFixed(x2 - nx, y2 - ny), toFixed(x1 - nx, y1 - ny));
+    }
+
+    /// @brief Adds axis aligned filled rectangle.
+    static void addBox(std::vector<XTriangle> &triangles, double left, double top, double right,
+                       double bottom)
+    {
+        addQuad(triangles, toFixed(left, top), toFixed(right, top), toFixed(right, bottom),
+                toFixed(left, bottom));
+    }
+
+    /// @brief Adds outline of the rectangle with mitered corners, same as SVG <rect>.
+    static void addRectangle(std::vector<XTriangle> &triangles, double x, double y, double w,
+                             double h)
+    {
+        const double k = kHalfStroke;
+        addBox(triangles, x - k, y - k, x + w + k, y + k);
+        addBox(triangles, x - k, y + h - k, x + w + k, y + h + k);
+        addBox(triangles, x - k, y + k, x + k, y + h - k);
+        addBox(triangles, x + w - k, y + k, x + w + k, y + h - k);
+    }
+
+    /// @brief Adds outline of the circle as ring of the segments, same as SVG <circle>.
+    static void addCircle(std::vector<XTriangle> &triangles, double cx, double cy, double r)
+    {
+        const double outer = r + kHalfStroke;
+        const double inner = r - kHalfStroke;
+        for (int i = 0; i < kCircleSegments; ++i)
+        {
+            const double a1 = 2.0 * M_PI * i / kCircleSegments;
+            const double a2 = 2.0 * M_PI * (i + 1) / kCircleSegments;
+            addQuad(triangles, toFixed(cx + outer * std::cos(a1), cy + outer * std::sin(a1)),
+                    toFixed(cx + outer * std::cos(a2), cy + outer * std::sin(a2)),
+                    toFixed(cx + inner * std::cos(a2), cy + inner * std::sin(a2)),
+                    toFixed(cx + inner * std::cos(a1), cy + inner * std::sin(a1)));
+        }
+    }
+
+    static draw_task::screen_rect_t
+    boundsOf(const std::vector<TPreparedShape::TColoredTriangles> &strokes)
+    {
+        double left = std::numeric_limits<double>::max();
+        double top = std::numeric_limits<double>::max();
+        double right = std::numeric_limits<double>::lowest();
+        double bottom = std::numeric_limits<double>::lowest();
+        for (const auto &stroke : strokes)
+        {
+            for (const auto &triangle : stroke.triangles)
+            {
+                for (const auto &point : {triangle.p1, triangle.p2, triangle.p3})
+                {
+                    left = std::min(left, XFixedToDouble(point.x));
+                    top = std::min(top, XFixedToDouble(point.y));
+                    right = std::max(right, XFixedToDouble(point.x));
+                    bottom = std::max(bottom, XFixedToDouble(point.y));
+                }
+            }
+        }
+        if (left > right)
+        {
+            return {};
+        }
+        const auto x = static_cast<int>(std::floor(left));
+        const auto y = static_cast<int>(std::floor(top));
+        return {x, y, static_cast<int>(std::ceil(right)) - x,
+                static_cast<int>(std::ceil(bottom)) - y};
+    }
+};
@@ -0,0 +1,290 @@
+#pragma once
+
+#include "cm_ctors.h"
+#include "opaque_ptr.h"
+
+#include <X11/X.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+/// @brief Uploads big images to X server by MIT-SHM, so pixels are not pushed through the socket.
+/// @details Shared memory segments are reused: each is sized up to power of 2 and returned to the
+/// pool once server has read it. Server reports it by completion event, which must be passed to
+/// handleEvent(). If too many segments are busy, single XSync() waits for all of them.
+/// If extension is missing or cannot be used (i.e. remote display) putImage() refuses and caller
+/// should use XPutImage().
+class MyXShmImagePool
+{
+  public:
+    NO_COPYMOVE(MyXShmImagePool);
+    MyXShmImagePool() = delete;
+
+    MyXShmImagePool(const opaque_ptr<Display> &g_display, Visual *visual, int depth) :
+        g_display(g_display),
+        visual(visual),
+        depth(depth)
+    {
+        available = XShmQueryExtension(g_display) && canAttach();
+        if (available)
+        {
+            completionEventType = XShmGetEventBase(g_display) + ShmCompletion;
+        }
+        else
+        {
+            std::cerr << "MIT-SHM is not available, images will be sent over X socket."
+                      << std::endl;
+        }
+    }
+
+    ~MyXShmImagePool()
+    {
+        busySegments.clear();
+        freeSegments.clear();
+    }
+
+    [[nodiscard]]
+    bool isAvailable() const
+    {
+        return available;
+    }
+
+    /// @brief Puts premultiplied ARGB32 @p pixels into (@p x; @p y) of the @p drawable.
+    /// @returns false if image was not sent, caller should fallback to XPutImage().
+    bool putImage(Drawable drawable, GC gc, int x, int y, const std::uint32_t *pixels, int width,
+                  int height)
+    {
+        const auto bytes = static_cast<std::size_t>(width) * static_cast<std::size_t>(height)
+                           * sizeof(std::uint32_t);
+        if (!available || bytes < kMinShmBytes)
+        {
+            return false;
+        }
+
+        auto segment = acquire(bytes);
+        if (!segment)
+        {
+            return false;
+        }
+
+        XImage *image = XShmCreateImage(g_display, visual, depth, ZPixmap, segment->info.shmaddr,
+                                        &segment->info, width, height);
+        if (!image)
+        {
+            release(std::move(segment));
+            return false;
+        }
+
+        const auto row = static_cast<std::size_t>(width) * sizeof(std::uint32_t);
+        for (int y = 0; y < height; ++y)
+        {
+            std::memcpy(std::next(image->data, y * image->bytes_per_line),
+                        std::next(pixels, static_cast<std::size_t>(y) * width), row);
+        }
+
+        // Server must read the segment before it can be reused, it sends completion event then.
+        XShmPutImage(g_display, drawable, gc, image, 0, 0, x, y, width, height, True);
+        image->data = nullptr;
+        XDestroyImage(image);
+        busySegments.emplace_back(std::move(segment));
+        if (busySegments.size() > kMaxBusySegments)
+        {
+            waitBusySegments();
+        }
+        return true;
+    }
+
+    /// @brief Returns segment to the pool if @p event is completion of its put.
+    /// @returns true if @p event was consumed.
+    bool handleEvent(const XEvent &event)
+    {
+        if (!available || event.type != completionEventType)
+        {
+            return false;
+        }
+        const auto &completion = reinterpret_cast<const XShmCompletionEvent &>(event); // NOLINT
+        const auto it = std::find_if(busySegments.begin(), busySegments.end(),
+                                     [&completion](const auto &segment) {
+                                         return segment->info.shmseg == completion.shmseg;
+                                     });
+        if (it != busySegments.end())
+        {
+            auto segment = std::move(*it);
+            busySegments.erase(it);
+            release(std::move(segment));
+        }
+        return true;
+    }
+
+  private:
+    // FYI: Configurable values. Smaller images are cheaper to send by XPutImage.
+    static constexpr std::size_t kMinShmBytes = 64u * 1024u;
+    static constexpr std::size_t kMinSegmentBytes = 256u * 1024u;
+    static constexpr std::size_t kMaxFreeSegments = 4u;
+    static constexpr std::size_t kMaxBusySegments = 4u;
+
+    /// @brief Single attached shared memory segment.
+    class TSegment
+    {
+      public:
+        NO_COPYMOVE(TSegment);
+        TSegment() = delete;
+
+        TSegment(Display *display, std::size_t size) :
+            display(display),
+            size(size),
+            info(allocCType<XShmSegmentInfo>())
+        {
+            info.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600); // NOLINT
+            if (info.shmid < 0)
+            {
+                return;
+            }
+            info.shmaddr = static_cast<char *>(shmat(info.shmid, nullptr, 0));
+            if (info.shmaddr == reinterpret_cast<char *>(-1)) // NOLINT
+            {
+                info.shmaddr = nullptr;
+                shmctl(info.shmid, IPC_RMID, nullptr);
+                return;
+            }
+            info.readOnly = False;
+            attached = XShmAttach(display, &info) != 0;
+            XSync(display, False);
+            // Segment is destroyed by system once both sides detached.
+            shmctl(info.shmid, IPC_RMID, nullptr);
+        }
+
+        ~TSegment()
+        {
+            if (attached)
+            {
+                XShmDetach(display, &info);
+                XSync(display, False);
+            }
+            if (info.shmaddr)
+            {
+                shmdt(info.shmaddr);
+            }
+        }
+
+        [[nodiscard]]
+        bool isValid() const
+        {
+            return attached && info.shmaddr != nullptr;
+        }
+
+        Display *display;
+        std::size_t size;
+        XShmSegmentInfo info;
+        bool attached{false};
+    };
+
+    const opaque_ptr<Display> &g_display;
+    Visual *visual;
+    int depth;
+    bool available{false};
+    int completionEventType{-1};
+    std::vector<std::unique_ptr<TSegment>> freeSegments;
+    // Segments which server may still read, one put per segment.
+    std::vector<std::unique_ptr<TSegment>> busySegments;
+
+    /// @brief Waits until server read all busy segments, by single round trip for all of them.
+    void waitBusySegments()
+    {
+        XSync(g_display, False);
+        // All completions are queued by Xlib now, those are consumed here.
+        auto event = allocCType<XEvent>();
+        while (XCheckTypedEvent(g_display, completionEventType, &event))
+        {
+            handleEvent(event);
+        }
+        for (auto &segment : busySegments)
+        {
+            release(std::move(segment));
+        }
+        busySegments.clear();
+    }
+
+    static int &trappedErrorsCount()
+    {
+        static int count = 0;
+        return count;
+    }
+
+    static int trapError(Display *, XErrorEvent *)
+    {
+        ++trappedErrorsCount();
+        return 0;
+    }
+
+    /// @brief Tries to attach test segment, server refuses it if it cannot access our memory.
+    bool canAttach()
+    {
+        trappedErrorsCount() = 0;
+        const auto oldHandler = XSetErrorHandler(&MyXShmImagePool::trapError);
+        auto segment = std::make_unique<TSegment>(g_display, kMinSegmentBytes);
+        XSync(g_display, False);
+        XSetErrorHandler(oldHandler);
+
+        if (trappedErrorsCount() > 0 || !segment->isValid())
+        {
+            // Server did not attach it, so detach must not be sent.
+            segment->attached = false;
+            return false;
+        }
+        freeSegments.emplace_back(std::move(segment));
+        return true;
+    }
+
+    std::unique_ptr<TSegment> acquire(std::size_t bytes)
+    {
+        const auto it = std::find_if(freeSegments.begin(), freeSegments.end(),
+                                     [bytes](const auto &segment) {
+                                         return segment->size >= bytes;
+                                     });
+        if (it != freeSegments.end())
+        {
+            auto segment = std::move(*it);
+            freeSegments.erase(it);
+            return segment;
+        }
+
+        std::size_t size = kMinSegmentBytes;
+        while (size < bytes)
+        {
+            size *= 2u;
+        }
+        auto segment = std::make_unique<TSegment>(g_display, size);
+        if (!segment->isValid())
+        {
+            return nullptr;
+        }
+        return segment;
+    }
+
+    void release(std::unique_ptr<TSegment> segment)
+    {
+        // Keeping the pool sorted by size, so acquire() picks smallest segment which fits.
+        const auto it = std::lower_bound(freeSegments.begin(), freeSegments.end(), segment->size,
+                                         [](const auto &existing, std::size_t size) {
+                                             return existing->size < size;
+                                         });
+        freeSegments.insert(it, std::move(segment));
+        if (freeSegments.size() > kMaxFreeSegments)
+        {
+            // Dropping smallest, big ones are more expensive to create.
+            freeSegments.erase(freeSegments.begin());
+        }
+    }
+};
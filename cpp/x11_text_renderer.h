@@ -0,0 +1,553 @@
+#pragma once
+
+#include "cm_ctors.h"
+#include "drawables.h"
+#include "emoji_renderer.hpp"
+#include "font_path_or_family.hpp"
+#include "font_size.hpp"
+#include "lambda_visitors.hpp"
+#include "luna_default_fonts.h"
+#include "lru_cache.hpp"
+#include "managed_id.hpp"
+#include "opaque_ptr.h"
+#include "strutils.h"
+#include "unicode_splitter.hpp"
+#include "x11_colors_mgr.h"
+
+#include <X11/X.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/Xrender.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <variant>
+#include <vector>
+
+/// @brief Draws text directly by XRender, bypassing SVG generation and lunasvg.
+/// @details Glyphs are rasterized by FreeType once and uploaded into GlyphSet per font face and
+/// size, than strings are composited by glyph indexes. Emoji are uploaded once as ARGB pictures
+/// and composited next to the glyphs. Text which cannot be drawn this way (unknown color names,
+/// missing fonts) is reported to the caller, so it can fallback to SVG.
+/// Server side GlyphSets and emoji pictures are kept by LRU caches. Prepared text owns those it
+/// uses, so evicted one is freed once no prepared text uses it.
+class MyXGlyphTextRenderer
+{
+  public:
+    /// @brief Text laid out and uploaded to X server, ready to be composited.
+    struct TPreparedText
+    {
+        /// @brief Glyphs of the same GlyphSet positioned by own advances.
+        struct TGlyphRun
+        {
+            GlyphSet glyphSet{None};
+            // Origin of the first glyph.
+            int x{0};
+            int y{0};
+            std::vector<unsigned int> glyphs;
+        };
+
+        /// @brief Emoji picture positioned on the screen.
+        struct TEmojiPlacement
+        {
+            Picture picture{None};
+            draw_task::screen_rect_t rect;
+        };
+
+        Picture source{None};
+        std::vector<TGlyphRun> runs;
+        std::vector<TEmojiPlacement> emojis;
+        draw_task::screen_rect_t bounds;
+        // Server side GlyphSets and pictures used by runs and emojis.
+        std::vector<std::shared_ptr<const void>> resources;
+
+        /// @brief Adds glyphs and emojis of the @p other moved by (@p dx; @p dy).
+        void append(const TPreparedText &other, int dx, int dy)
+        {
+            for (auto run : other.runs)
+            {
+                run.x += dx;
+                run.y += dy;
+                runs.emplace_back(std::move(run));
+            }
+            for (auto emoji : other.emojis)
+            {
+                emoji.rect.x += dx;
+                emoji.rect.y += dy;
+                emojis.emplace_back(emoji);
+            }
+            if (!other.bounds.isEmpty())
+            {
+                bounds = bounds.united({other.bounds.x + dx, other.bounds.y + dy,
+                                        other.bounds.width, other.bounds.height});
+            }
+        }
+    };
+
+    /// @brief Uploads premultiplied ARGB32 pixels into the new pixmap.
+    using TUploadArgbPixmap =
+      std::function<TManagedId<Pixmap, None>(std::uint32_t *pixels, int width, int height)>;
+
+    NO_COPYMOVE(MyXGlyphTextRenderer);
+    MyXGlyphTextRenderer() = delete;
+
+    MyXGlyphTextRenderer(const opaque_ptr<Display> &g_display, TUploadArgbPixmap uploadPixmap) :
+        g_display(g_display),
+        maskFormat(XRenderFindStandardFormat(g_display, PictStandardA8)),
+        argbFormat(XRenderFindStandardFormat(g_display, PictStandardARGB32)),
+        uploadPixmap(std::move(uploadPixmap))
+    {
+    }
+
+    ~MyXGlyphTextRenderer()
+    {
+        preparedLines.clear();
+        uploadedEmojis.clear();
+        colorSources.clear();
+        glyphSets.clear();
+    }
+
+    /// @returns text ready to be drawn or std::nullopt if @p drawitem cannot be drawn natively.
+    /// @note Lines are laid out once and cached, so changed text lays out changed lines only.
+    std::optional<TPreparedText> prepare(const draw_task::drawitem_t &drawitem)
+    {
+        TPreparedText result;
+        result.source = colorSource(drawitem.color);
+        if (result.source == None)
+        {
+            return std::nullopt;
+        }
+
+        const auto fontSize = drawitem.text.getFinalFontSize();
+        int lineTop = drawitem.y;
+        for (const auto &line : drawitem.text.getLinesToDraw())
+        {
+            if (!appendLine(result, line, fontSize, drawitem.x, lineTop))
+            {
+                return std::nullopt;
+            }
+            lineTop += drawitem.text.getLineHeight();
+        }
+
+        return result;
+    }
+
+    /// @brief Composites prepared @p text into @p destination.
+    void draw(const TPreparedText &text, Picture destination) const
+    {
+        for (const auto &run : text.runs)
+        {
+            XRenderCompositeString32(g_display, PictOpOver, text.source, destination, maskFormat,
+                                     run.glyphSet, 0, 0, run.x, run.y, run.glyphs.data(),
+                                     static_cast<int>(run.glyphs.size()));
+        }
+        for (const auto &emoji : text.emojis)
+        {
+            XRenderComposite(g_display, PictOpOver, emoji.picture, None, destination, 0, 0, 0, 0,
+                             emoji.rect.x, emoji.rect.y, emoji.rect.width, emoji.rect.height);
+        }
+    }
+
+    ///@returns solid fill picture of the given color or None if color is not recognized.
+    Picture colorSource(const std::string &colorName)
+    {
+        const auto name = utility::toLower(colorName);
+        const auto it = colorSources.find(name);
+        if (it != colorSources.end())
+        {
+            return it->second;
+        }
+
+        const auto rgba = MyXOverlayColorMap::tryDecodeRGBAColor(name);
+        if (!rgba)
+        {
+            return None;
+        }
+        const auto renderColor = rgba->toPremultipliedRenderColor();
+        auto &source = colorSources[name];
+        source = TManagedId<Picture, None>{XRenderCreateSolidFill(g_display, &renderColor),
+                                           [this](Picture id) {
+                                               XRenderFreePicture(g_display, id);
+                                           }};
+        return source;
+    }
+
+  private:
+    using TGlyphSetKey = std::tuple<FontPathOrFamily, std::uint32_t>;
+
+    struct TGlyphSetKeyHash
+    {
+        std::size_t operator()(const TGlyphSetKey &key) const
+        {
+            static const LambdaVisitor hashFont{
+              [](const std::filesystem::path &p) {
+                  return std::filesystem::hash_value(p);
+              },
+              [](const std::string &s) {
+                  return std::hash<std::string>{}(s);
+              },
+            };
+            return std::visit(hashFont, std::get<0>(key))
+                   ^ (static_cast<std::size_t>(std::get<1>(key)) << 1u);
+        }
+    };
+
+    /// @brief Text of the line and font size, color is not needed as it is applied on draw.
+    struct TLineKey
+    {
+        std::string text;
+        std::uint32_t fontSize;
+
+        bool operator==(const TLineKey &other) const
+        {
+            return fontSize == other.fontSize && text == other.text;
+        }
+    };
+
+    struct TLineKeyHash
+    {
+        std::size_t operator()(const TLineKey &key) const
+        {
+            const std::size_t textHash = std::hash<std::string>{}(key.text);
+            return textHash ^ (static_cast<std::size_t>(key.fontSize) << 1u);
+        }
+    };
+
+    // FYI: Configurable values. Amount of the laid out lines and font face + size GlyphSets kept
+    // on server. Emoji pictures on server are the same bytes as bitmaps of the emoji renderer, so
+    // those are bounded by its budget.
+    static constexpr std::size_t kMaxPreparedLines = 1024;
+    static constexpr std::size_t kMaxGlyphSets = 32;
+
+    /// @brief Server side glyphs of the single font face of the single size.
+    struct TUploadedGlyphSet
+    {
+        TManagedId<GlyphSet, None> glyphSet;
+        std::map<unsigned int, XGlyphInfo> glyphs;
+    };
+
+    /// @brief Server side picture of the single emoji.
+    struct TUploadedEmoji
+    {
+        TManagedId<Pixmap, None> pixmap;
+        TManagedId<Picture, None> picture;
+        int width{0};
+        int height{0};
+    };
+
+    using TUploadedGlyphSetPtr = std::shared_ptr<TUploadedGlyphSet>;
+    using TUploadedEmojiPtr = std::shared_ptr<const TUploadedEmoji>;
+
+    struct TUploadedEmojiCost
+    {
+        std::size_t operator()(const TUploadedEmojiPtr &uploaded) const
+        {
+            // Failed ones are kept too, so those cost something.
+            constexpr std::size_t kMinCost = 64u;
+            return std::max(kMinCost, static_cast<std::size_t>(uploaded->width)
+                                        * static_cast<std::size_t>(uploaded->height) * 4u);
+        }
+    };
+
+    /// @brief Line placed at (0;0). It does not own server side resources, so cache does not
+    /// keep evicted ones alive.
+    struct TPreparedLine
+    {
+        TPreparedText text;
+        std::vector<std::weak_ptr<const void>> resources;
+    };
+    using TPreparedLinePtr = std::shared_ptr<const TPreparedLine>;
+
+    const opaque_ptr<Display> &g_display;
+    XRenderPictFormat *maskFormat;
+    XRenderPictFormat *argbFormat;
+    TUploadArgbPixmap uploadPixmap;
+    utility::LruCache<TGlyphSetKey, TUploadedGlyphSetPtr, TGlyphSetKeyHash> glyphSets{
+      kMaxGlyphSets};
+    std::map<std::string, TManagedId<Picture, None>> colorSources;
+    utility::LruCache<emoji::EmojiToRender, TUploadedEmojiPtr, emoji::EmojiToRenderHash,
+                      TUploadedEmojiCost>
+      uploadedEmojis{emoji::kBitmapCacheBudget};
+    // Failed lines are kept as nullptr.
+    utility::LruCache<TLineKey, TPreparedLinePtr, TLineKeyHash> preparedLines{kMaxPreparedLines};
+
+    /// @brief Adds @p resource to @p owners once.
+    static void addResource(std::vector<std::shared_ptr<const void>> &owners,
+                            std::shared_ptr<const void> resource)
+    {
+        if (std::find(owners.begin(), owners.end(), resource) == owners.end())
+        {
+            owners.emplace_back(std::move(resource));
+        }
+    }
+
+    /// @brief Appends glyphs and emojis of the single @p line moved by (@p dx; @p dy) to
+    /// @p result. Cached line is laid out again if some of its resources were evicted.
+    /// @returns false if line cannot be drawn natively.
+    bool appendLine(TPreparedText &result, const std::string &line,
+                    font_size::FontPixelSize fontSize, int dx, int dy)
+    {
+        const TLineKey key{line, fontSize.size};
+        if (const auto *cached = preparedLines.find(key))
+        {
+            if (!*cached)
+            {
+                return false;
+            }
+            std::vector<std::shared_ptr<const void>> locked;
+            for (const auto &resource : (*cached)->resources)
+            {
+                locked.emplace_back(resource.lock());
+            }
+            if (std::all_of(locked.begin(), locked.end(), [](const auto &ptr) {
+                    return ptr != nullptr;
+                }))
+            {
+                for (auto &resource : locked)
+                {
+                    addResource(result.resources, std::move(resource));
+                }
+                result.append((*cached)->text, dx, dy);
+                return true;
+            }
+        }
+
+        const auto prepared = prepareLine(line, fontSize);
+        if (!prepared)
+        {
+            preparedLines.insert(key, nullptr);
+            return false;
+        }
+        auto cachedLine = std::make_shared<TPreparedLine>();
+        cachedLine->text = *prepared;
+        cachedLine->text.resources.clear();
+        for (const auto &resource : prepared->resources)
+        {
+            cachedLine->resources.emplace_back(resource);
+            addResource(result.resources, resource);
+        }
+        result.append(cachedLine->text, dx, dy);
+        preparedLines.insert(key, std::move(cachedLine));
+        return true;
+    }
+
+    /// @returns glyphs and emojis of the single @p line placed at (0;0), those own resources they
+    /// use, or std::nullopt if it cannot be drawn natively.
+    std::optional<TPreparedText> prepareLine(const std::string &line,
+                                             font_size::FontPixelSize fontSize)
+    {
+        const emoji::EmojiFontRequirement font{fontSize, GetTextFonts()};
+        TPreparedText result;
+        int x = 0;
+        for (const auto &span : makeSpans(line))
+        {
+            if (span.needsCustomRender())
+            {
+                addEmojis(result, line, span, fontSize, x, 0);
+                continue;
+            }
+
+            std::vector<char32_t> symbols;
+            const auto sub = line.substr(span.begin, span.end - span.begin);
+            for (UnicodeSymbolsIterator iter(sub); iter.next();)
+            {
+                symbols.emplace_back(iter.symbol());
+            }
+            const auto layout = emoji::EmojiRenderer::instance().layoutLine(font, symbols);
+            if (!layout.isValid())
+            {
+                return std::nullopt;
+            }
+            for (const auto &run : layout.runs)
+            {
+                const auto uploaded = uploadGlyphs(run, fontSize);
+                addResource(result.resources, uploaded);
+                // Same as SVG's <text> tag, y of the text is baseline.
+                addGlyphs(result, *uploaded, run, x + run.x, static_cast<int>(fontSize.size));
+            }
+            x += static_cast<int>(layout.width);
+        }
+        return result;
+    }
+
+    /// @brief Uploads glyphs of the @p run which are not on server yet, all in single request.
+    TUploadedGlyphSetPtr uploadGlyphs(const emoji::FontRun &run, font_size::FontPixelSize fontSize)
+    {
+        const TGlyphSetKey key{run.font, fontSize.size};
+        const auto *cached = glyphSets.find(key);
+        const auto uploadedPtr = cached ? *cached : glyphSets.insert(key, createGlyphSet());
+        auto &uploaded = *uploadedPtr;
+
+        std::vector<Glyph> ids;
+        std::vector<XGlyphInfo> infos;
+        std::vector<char> images;
+        for (const auto &glyph : run.glyphs)
+        {
+            if (uploaded.glyphs.count(glyph.glyphIndex) > 0)
+            {
+                continue;
+            }
+            const auto image =
+              emoji::EmojiRenderer::instance().renderGlyph(run.font, fontSize, glyph.glyphIndex);
+
+            XGlyphInfo info{};
+            info.width = static_cast<unsigned short>(image.width);
+            info.height = static_cast<unsigned short>(image.height);
+            info.x = static_cast<short>(-image.left);
+            info.y = static_cast<short>(image.top);
+            info.xOff = static_cast<short>(image.advanceX);
+            info.yOff = 0;
+
+            // A8 glyph images must have rows padded to 4 bytes.
+            const std::size_t stride = (image.width + 3u) & ~3u;
+            const auto offset = images.size();
+            images.resize(offset + stride * image.height, 0);
+            for (std::size_t y = 0; y < image.height; ++y)
+            {
+                std::copy_n(std::next(image.coverage.begin(), y * image.width), image.width,
+                            std::next(images.begin(), offset + y * stride));
+            }
+
+            ids.emplace_back(glyph.glyphIndex);
+            infos.emplace_back(info);
+            uploaded.glyphs.emplace(glyph.glyphIndex, info);
+        }
+
+        if (!ids.empty())
+        {
+            XRenderAddGlyphs(g_display, uploaded.glyphSet, ids.data(), infos.data(),
+                             static_cast<int>(ids.size()), images.data(),
+                             static_cast<int>(images.size()));
+        }
+        return uploadedPtr;
+    }
+
+    TUploadedGlyphSetPtr createGlyphSet() const
+    {
+        auto uploaded = std::make_shared<TUploadedGlyphSet>();
+        uploaded->glyphSet = TManagedId<GlyphSet, None>{
+          XRenderCreateGlyphSet(g_display, maskFormat), [this](GlyphSet id) {
+              XRenderFreeGlyphSet(g_display, id);
+          }};
+        return uploaded;
+    }
+
+    /// @brief Uploads emoji once, failed ones are remembered too, so those are not retried.
+    TUploadedEmojiPtr uploadEmoji(const emoji::EmojiToRender &what)
+    {
+        if (const auto *cached = uploadedEmojis.find(what))
+        {
+            return *cached;
+        }
+        auto uploaded = createEmoji(what);
+        return uploadedEmojis.insert(what, std::move(uploaded));
+    }
+
+    TUploadedEmojiPtr createEmoji(const emoji::EmojiToRender &what) const
+    {
+        auto result = std::make_shared<TUploadedEmoji>();
+        auto &uploaded = *result;
+        const auto rendered = emoji::EmojiRenderer::instance().renderToBitmap(what);
+        const auto &bitmap = *rendered;
+        if (!bitmap.isValid())
+        {
+            return result;
+        }
+
+        std::vector<std::uint32_t> argb(static_cast<std::size_t>(bitmap.width) * bitmap.height);
+        for (std::size_t i = 0; i < argb.size(); ++i)
+        {
+            const auto *rgba = std::next(bitmap.pixels.data(), i * 4);
+            const std::uint32_t alpha = rgba[3]; // NOLINT
+            const auto premultiply = [alpha](std::uint32_t color) {
+                return (color * alpha) / 0xFFu;
+            };
+            // NOLINTNEXTLINE
+            argb[i] = (alpha << 24) | (premultiply(rgba[0]) << 16) | (premultiply(rgba[1]) << 8)
+                      | premultiply(rgba[2]); // NOLINT
+        }
+
+        const auto width = static_cast<int>(bitmap.width);
+        const auto height = static_cast<int>(bitmap.height);
+        uploaded.pixmap = uploadPixmap(argb.data(), width, height);
+        if (!uploaded.pixmap.IsInitialized())
+        {
+            return result;
+        }
+        uploaded.picture = TManagedId<Picture, None>{
+          XRenderCreatePicture(g_display, uploaded.pixmap, argbFormat, 0, nullptr),
+          [this](Picture id) {
+              XRenderFreePicture(g_display, id);
+          }};
+        uploaded.width = width;
+        uploaded.height = height;
+        return result;
+    }
+
+    /// @brief Places emoji of the @p span one by one starting at @p x, same way as SVG <image>
+    /// tags are placed. Moves @p x to the end of the span.
+    void addEmojis(TPreparedText &text, const std::string &line, const SpanRange &span,
+                   font_size::FontPixelSize fontSize, int &x, int lineTop)
+    {
+        UnicodeSymbolsIterator iter(line);
+        if (!iter.rewindTo(span))
+        {
+            return;
+        }
+        do
+        {
+            const auto uploadedPtr =
+              uploadEmoji({iter.symbol(), emoji::EmojiFontRequirement{fontSize, GetEmojiFonts()}});
+            const auto &uploaded = *uploadedPtr;
+            if (uploaded.picture.IsInitialized())
+            {
+                const draw_task::screen_rect_t rect{x, lineTop, uploaded.width, uploaded.height};
+                text.emojis.push_back({uploaded.picture, rect});
+                text.bounds = text.bounds.united(rect);
+                addResource(text.resources, uploadedPtr);
+                x += uploaded.width
+                     + std::min(3, static_cast<int>(static_cast<float>(uploaded.width) * 0.05f));
+            }
+        }
+        while (iter.next() && span.cls == iter.classify());
+    }
+
+    /// @brief Splits glyphs into runs which XRender can position by glyph advances, kerning
+    /// starts new run.
+    static void addGlyphs(TPreparedText &text, const TUploadedGlyphSet &uploaded,
+                        const emoji::FontRun &fontRun, int x, int baseline)
+    {
+        TPreparedText::TGlyphRun run;
+        int expectedPenX = 0;
+        for (const auto &glyph : fontRun.glyphs)
+        {
+            const auto &info = uploaded.glyphs.at(glyph.glyphIndex);
+            if (run.glyphs.empty() || glyph.penX != expectedPenX)
+            {
+                if (!run.glyphs.empty())
+                {
+                    text.runs.emplace_back(std::move(run));
+                }
+                run = {uploaded.glyphSet, x + glyph.penX, baseline, {}};
+            }
+            run.glyphs.emplace_back(glyph.glyphIndex);
+            expectedPenX = glyph.penX + info.xOff;
+
+            text.bounds = text.bounds.united(
+              {x + glyph.penX - info.x, baseline - info.y, info.width, info.height});
+        }
+        if (!run.glyphs.empty())
+        {
+            text.runs.emplace_back(std::move(run));
+        }
+    }
+};
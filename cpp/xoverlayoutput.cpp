@@ -2,11 +2,18 @@
 
 #include "cm_ctors.h"
 #include "drawables.h"
+#include "lru_cache.hpp"
 #include "luna_default_fonts.h"
 #include "managed_id.hpp"
 #include "opaque_ptr.h"
 #include "svgbuilder.h"
+#include "thread_pool.hpp"
 #include "x11_colors_mgr.h"
+#include "x11_raster_atlas.h"
+#include "x11_raster_cache.h"
+#include "x11_shape_renderer.h"
+#include "x11_shm_image_pool.h"
+#include "x11_text_renderer.h"
 
 #include <X11/X.h>
 #include <X11/Xlib.h>
@@ -19,23 +26,48 @@
 
 #include <lunasvg.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
 #include <exception>
 #include <functional>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <stdexcept>
 #include <string>
-#include <tuple>
+#include <thread>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace {
 
 using TManagedPixmap = TManagedId<Pixmap, None>;
 
+constexpr int kBitnessWithAlpha = 32;
+
+// FYI: Configurable value, memory of the X server used by cached SVG rasters.
+constexpr std::size_t kRasterCacheBudget = 64u * 1024u * 1024u;
+
+// FYI: Configurable value, count of the unrenderable SVGs remembered, so those are not retried.
+constexpr std::size_t kMaxFailedRasters = 256u;
+
+// FYI: Configurable value, max threads rasterizing SVGs.
+constexpr unsigned kMaxRasterThreads = 4u;
+
+std::size_t rasterThreadsCount()
+{
+    // One core is left for X thread.
+    const unsigned cores = std::thread::hardware_concurrency();
+    return std::clamp(cores > 1u ? cores - 1u : 1u, 1u, kMaxRasterThreads);
+}
+
 // Events for normal windows
 // NOLINTNEXTLINE
 constexpr long BASIC_EVENT_MASK = StructureNotifyMask | ExposureMask | PropertyChangeMask
@@ -51,6 +83,12 @@ enum class ETextDecor : std::uint8_t {
     Rectangle,
 };
 
+XRectangle toXRectangle(const draw_task::screen_rect_t &rect)
+{
+    return {static_cast<short>(rect.x), static_cast<short>(rect.y),
+            static_cast<unsigned short>(rect.width), static_cast<unsigned short>(rect.height)};
+}
+
 int XMyDestroyImage(XImage *ptr)
 {
     // This is macro..and we need a function.
@@ -111,14 +149,68 @@ class XPrivateAccess
     XVisualInfo g_vinfo{allocCType<XVisualInfo>()};
 
     std::shared_ptr<MyXOverlayColorMap> colors{nullptr};
+    std::unique_ptr<MyXGlyphTextRenderer> textRenderer{nullptr};
+    std::unique_ptr<MyXShapeRenderer> shapeRenderer{nullptr};
+    std::unique_ptr<MyXShmImagePool> shmImagePool{nullptr};
+    std::unique_ptr<MyXRasterAtlas> rasterAtlas{nullptr};
+    std::unique_ptr<MyXRasterCache> rasterCache{nullptr};
+
+    // SVGs are rasterized by pool threads, X thread uploads results.
+    struct TRasterized
+    {
+        draw_task::drawitem_t::drawsvg_t svg;
+        lunasvg::Bitmap bitmap;
+        bool cancelled{false};
+    };
+    // Pool thread drops the job once no id waits for it anymore.
+    struct TRasterJob
+    {
+        std::atomic<std::size_t> waiters{0};
+    };
+    using TRasterJobPtr = std::shared_ptr<TRasterJob>;
+    // Item can wait for several rasters, i.e. shape for texts of its markers.
+    struct TRasterWaiter
+    {
+        std::uint64_t generation;
+        std::vector<TRasterJobPtr> jobs;
+    };
+    using TSvgHash = MyXRasterCache::TSvgHash;
+    std::unordered_map<draw_task::drawitem_t::drawsvg_t, TRasterJobPtr, TSvgHash> rasterJobs;
+    // Hashes of the SVGs which lunasvg could not render, content is not kept.
+    utility::LruCache<std::size_t, bool> failedRasters{kMaxFailedRasters};
+    // Latest generation of each id waiting for its SVG to be rasterized.
+    std::unordered_map<std::string, TRasterWaiter> rasterWaiters;
+    std::mutex rasterizedMutex;
+    std::vector<TRasterized> rasterized;
+    // Called by pool thread when something is rasterized.
+    std::function<void()> wakeup{nullptr};
+    std::unique_ptr<utility::ThreadPool> rasterPool{nullptr};
 
     opaque_ptr<Display> g_display{nullptr};
     Window g_root{0};
     int g_screen{0};
     Window g_win{0};
+    Atom activeWindowAtom{None};
     opaque_ptr<_XGC> single_gc{nullptr};
+    // Never clipped, unlike single_gc which is clipped to the damage while redrawing.
+    opaque_ptr<_XGC> upload_gc{nullptr};
+    // Resolved once, all our pixmaps are ARGB32.
+    XRenderPictFormat *argbFormat{nullptr};
     TManagedId<Picture, None> g_windowOpaqueDestination;
 
+    // Everything is composited into this ARGB buffer first, then it is presented to the window by
+    // single blit per frame, so compositor sees exactly 1 update.
+    TManagedPixmap backBuffer;
+    TManagedId<Picture, None> backBufferPicture;
+    // Parts of the back buffer changed since last present().
+    std::vector<XRectangle> presentDamage;
+    bool presentFull{true};
+
+    // Area drawn last time per item's id, it is used to find damaged parts of the window.
+    std::map<std::string, draw_task::screen_rect_t> drawnBounds;
+    // Whole window must be repainted on next redrawDamaged(), i.e. it was cleaned.
+    bool fullRepaintRequired{true};
+
   public:
     ///@brief Allocates RAII style memory.
     template <typename T, typename taDeAllocator, typename taAllocator, typename... taAllocArgs>
@@ -165,13 +257,38 @@ class XPrivateAccess
         createShapedWindow();
 
         single_gc = Allocate<_XGC>(XFreeGC, XCreateGC, g_display, g_win, 0, nullptr);
+        upload_gc = Allocate<_XGC>(XFreeGC, XCreateGC, g_display, g_win, 0, nullptr);
+        argbFormat = XRenderFindStandardFormat(g_display, PictStandardARGB32);
         colors = std::make_shared<MyXOverlayColorMap>(g_display, getAttributes());
+        shmImagePool =
+          std::make_unique<MyXShmImagePool>(g_display, g_vinfo.visual, kBitnessWithAlpha);
+        rasterAtlas = std::make_unique<MyXRasterAtlas>(g_display, g_win);
+        rasterCache = std::make_unique<MyXRasterCache>(kRasterCacheBudget);
+        rasterPool = std::make_unique<utility::ThreadPool>(rasterThreadsCount());
+        textRenderer = std::make_unique<MyXGlyphTextRenderer>(
+          g_display, [this](std::uint32_t *pixels, int width, int height) {
+              return UploadArgbPixmap(pixels, width, height);
+          });
+        shapeRenderer =
+          std::make_unique<MyXShapeRenderer>(g_display, [this](const std::string &color) {
+              return textRenderer->colorSource(color);
+          });
+        createBackBuffer();
     }
 
     ~XPrivateAccess()
     {
+        rasterPool.reset();
+        shapeRenderer.reset();
+        textRenderer.reset();
+        rasterCache.reset();
+        rasterAtlas.reset();
+        shmImagePool.reset();
         colors.reset();
+        backBufferPicture.reset();
+        backBuffer.reset();
         g_windowOpaqueDestination.reset();
+        upload_gc.reset();
         single_gc.reset();
         g_display.reset();
 
@@ -187,13 +304,43 @@ class XPrivateAccess
             const auto &transparent = colors->get("transparent");
             XSetBackground(g_display, gc, white.pixel);
             XSetForeground(g_display, gc, transparent.pixel);
-            XFillRectangle(g_display, g_win, gc, 0, 0, window_width, window_height);
+            XFillRectangle(g_display, backBuffer, gc, 0, 0, window_width, window_height);
         }
     }
 
-    void cleanGC() const
+    void cleanGC()
     {
         cleanGC(single_gc);
+        drawnBounds.clear();
+        fullRepaintRequired = true;
+        presentFull = true;
+    }
+
+    ///@brief Copies changed parts of the back buffer to the window by single composite.
+    void present()
+    {
+        if (!presentFull && presentDamage.empty())
+        {
+            return;
+        }
+
+        XserverRegion region = None;
+        if (!presentFull)
+        {
+            region = XFixesCreateRegion(g_display, presentDamage.data(),
+                                        static_cast<int>(presentDamage.size()));
+            XFixesSetPictureClipRegion(g_display, windowPicture(), 0, 0, region);
+        }
+        XRenderComposite(g_display, PictOpSrc, backBufferPicture, None, windowPicture(), 0, 0, 0,
+                         0, 0, 0, window_width, window_height);
+        if (region != None)
+        {
+            XFixesSetPictureClipRegion(g_display, windowPicture(), 0, 0, None);
+            XFixesDestroyRegion(g_display, region);
+        }
+
+        presentDamage.clear();
+        presentFull = false;
     }
 
     void flush() const
@@ -201,6 +348,54 @@ class XPrivateAccess
         XFlush(g_display);
     }
 
+    [[nodiscard]]
+    int getEventsFd() const
+    {
+        return ConnectionNumber(g_display);
+    }
+
+    void setWakeup(std::function<void()> callback)
+    {
+        wakeup = std::move(callback);
+    }
+
+    ///@brief Reads all queued events, so they do not pile up in Xlib, and uploads rasterized SVGs.
+    TProcessedEvents processEvents()
+    {
+        TProcessedEvents result;
+        result.needsRepaint = uploadRasterized();
+        while (XPending(g_display) > 0)
+        {
+            auto event = allocCType<XEvent>();
+            XNextEvent(g_display, &event);
+            switch (event.type)
+            {
+                case PropertyNotify:
+                    result.windowChanged = result.windowChanged
+                                           || (event.xproperty.window == g_root
+                                               && event.xproperty.atom == activeWindowAtom);
+                    break;
+                case Expose:
+                case MapNotify:
+                    presentFull = true;
+                    result.needsRepaint = true;
+                    result.windowChanged = true;
+                    break;
+                default:
+                    shmImagePool->handleEvent(event);
+                    break;
+            }
+        }
+        return result;
+    }
+
+    ///@returns true if Xlib has read events which are not processed yet, i.e. during XSync().
+    [[nodiscard]]
+    bool hasQueuedEvents() const
+    {
+        return XEventsQueued(g_display, QueuedAlready) > 0;
+    }
+
     /// @returns true if transparency is avail in system now.
     [[nodiscard]]
     bool isTransparencyAvail() const
@@ -231,48 +426,310 @@ class XPrivateAccess
         return getWindowPropertyInt<std::uint32_t>("_NET_WM_PID", focused);
     }
 
-    ///@brief Draws SVG file on the screen.
-    void drawAsSvg(const draw_task::drawitem_t &drawitem)
+    ///@brief Takes SVG raster from the cache and sets bounds of the @p drawitem. On miss SVG is
+    /// sent to rasterization by pool.
+    ///@returns false if SVG is not rasterized yet or could not be rendered.
+    bool prepareSvg(const draw_task::drawitem_t &drawitem)
     {
         assert(drawitem.drawmode == draw_task::drawmode_t::svg);
-        InstallNormalFontFileToLuna(drawitem.svg.fontFile);
+        if (drawitem.render)
+        {
+            return true;
+        }
 
-        if (!drawitem.svg.render)
+        auto raster = rasterCache->find(drawitem.svg);
+        if (!raster)
         {
-            auto pixmap = RenderXPixmapFromSvgText(drawitem.svg.svg, drawitem.svg.css);
-            if (!std::get<0>(pixmap).IsInitialized())
+            drawitem.bounds = {};
+            requestRaster(drawitem);
+            return false;
+        }
+        drawitem.bounds = {drawitem.x, drawitem.y, raster->width, raster->height};
+
+        auto renderer = [this, raster = std::move(raster), &drawitem]() {
+            XRenderComposite(g_display, PictOpOver, raster->sourcePicture(), None,
+                             backBufferPicture, raster->sourceX(), raster->sourceY(), 0, 0,
+                             drawitem.x, drawitem.y, raster->width, raster->height);
+        };
+        drawitem.render = std::move(renderer);
+        return true;
+    }
+
+    ///@brief Lays out text and uploads its glyphs once, sets bounds of the @p drawitem.
+    ///@note Text which cannot be drawn by glyphs is converted to SVG.
+    ///@returns false if text could not be drawn at all.
+    bool prepareText(const draw_task::drawitem_t &drawitem)
+    {
+        assert(drawitem.drawmode == draw_task::drawmode_t::text);
+        if (drawitem.render)
+        {
+            return true;
+        }
+        if (drawitem.svgFallback)
+        {
+            return prepareAsSvg(drawitem);
+        }
+
+        auto prepared = textRenderer->prepare(drawitem);
+        if (!prepared)
+        {
+            return prepareAsSvg(drawitem);
+        }
+
+        drawitem.bounds = prepared->bounds;
+        drawitem.render = [this, text = std::make_shared<MyXGlyphTextRenderer::TPreparedText>(
+                                   std::move(*prepared))]() {
+            textRenderer->draw(*text, backBufferPicture);
+        };
+        return true;
+    }
+
+    ///@brief Converts shape into triangles once, sets bounds of the @p drawitem.
+    ///@note Texts of the markers use text path, shapes of unknown colors are converted to SVG.
+    /// Shape is not prepared until SVGs of all its marker texts are rasterized, triangles are kept
+    /// by @p drawitem meanwhile.
+    ///@returns false if shape could not be drawn at all or is not ready yet.
+    bool prepareShape(const draw_task::drawitem_t &drawitem)
+    {
+        using TPreparedShape = MyXShapeRenderer::TPreparedShape;
+        assert(drawitem.drawmode == draw_task::drawmode_t::shape);
+        if (drawitem.render)
+        {
+            return true;
+        }
+        if (drawitem.svgFallback)
+        {
+            return prepareAsSvg(drawitem);
+        }
+
+        auto prepared = std::static_pointer_cast<TPreparedShape>(drawitem.pendingNative);
+        if (!prepared)
+        {
+            auto shape = shapeRenderer->prepare(drawitem);
+            if (!shape)
             {
-                return;
+                return prepareAsSvg(drawitem);
             }
-            auto renderer = [this,
-                             shared_pixmap = std::make_shared<TPixmapWithDims>(std::move(pixmap)),
-                             &drawitem]() {
-                const auto &[pixmap_id, pixmap_width, pixmap_height] = *shared_pixmap;
-                XRenderPictFormat *pictFormat = XRenderFindVisualFormat(g_display, g_vinfo.visual);
-                auto srcPict = AllocateId<Picture>(XRenderFreePicture, XRenderCreatePicture,
-                                                   g_display, pixmap_id, pictFormat, 0, nullptr);
-                if (!g_windowOpaqueDestination.IsInitialized())
+            prepared = std::make_shared<TPreparedShape>(std::move(*shape));
+        }
+
+        auto bounds = prepared->bounds;
+        for (auto &text : prepared->markerTexts)
+        {
+            // Rasters of the texts are waited by the shape.
+            text.id = drawitem.id;
+            text.generation = drawitem.generation;
+            if (prepareText(text))
+            {
+                bounds = bounds.united(text.bounds);
+            }
+        }
+        if (isWaitingRaster(drawitem))
+        {
+            drawitem.bounds = {};
+            drawitem.pendingNative = std::move(prepared);
+            return false;
+        }
+        drawitem.pendingNative = nullptr;
+        drawitem.bounds = bounds;
+        drawitem.render = [this, shape = std::move(prepared)]() {
+            shapeRenderer->draw(*shape, backBufferPicture);
+            for (const auto &text : shape->markerTexts)
+            {
+                if (text.render)
                 {
-                    g_windowOpaqueDestination =
-                      AllocateId<Picture>(XRenderFreePicture, XRenderCreatePicture, g_display,
-                                          g_win, pictFormat, 0, nullptr);
+                    text.render();
                 }
-                XRenderComposite(g_display, PictOpOver, srcPict, None, g_windowOpaqueDestination, 0,
-                                 0, 0, 0, drawitem.x, drawitem.y, pixmap_width, pixmap_height);
-            };
-            drawitem.svg.render = std::move(renderer);
+            }
+        };
+        return true;
+    }
+
+    ///@brief Fallback for the drawables which cannot be drawn natively: converts @p drawitem to
+    /// SVG once and prepares it, so pending raster costs single lookup per frame.
+    bool prepareAsSvg(const draw_task::drawitem_t &drawitem)
+    {
+        if (!drawitem.svgFallback)
+        {
+            drawitem.svgFallback = std::make_shared<const draw_task::drawitem_t>(
+              SvgBuilder(window_width, window_height, drawitem).BuildSvgTask());
+        }
+        const auto svgTask = drawitem.svgFallback;
+        if (!prepareSvg(*svgTask))
+        {
+            drawitem.bounds = {};
+            return false;
+        }
+        drawitem.bounds = svgTask->bounds;
+        drawitem.render = [svgTask]() {
+            svgTask->render();
+        };
+        return true;
+    }
+
+    ///@brief Prepares @p drawitem for the output once, so it has valid bounds and render.
+    ///@returns false if item cannot be drawn.
+    bool prepareItem(const draw_task::drawitem_t &drawitem)
+    {
+        switch (drawitem.drawmode)
+        {
+            case draw_task::drawmode_t::svg:
+                return prepareSvg(drawitem);
+            case draw_task::drawmode_t::text:
+                return prepareText(drawitem);
+            case draw_task::drawmode_t::shape:
+                return prepareShape(drawitem);
+            default:
+                return false;
+        }
+    }
+
+    ///@brief Draws single item over the current content, bypassing damage tracking.
+    void drawOver(const draw_task::drawitem_t &drawitem)
+    {
+        drawItem(drawitem);
+        if (!drawitem.bounds.isEmpty())
+        {
+            presentDamage.push_back(toXRectangle(drawitem.bounds));
+        }
+    }
+
+    ///@brief Repaints only parts of the window covered by new, changed or removed @p items.
+    ///@note Changed items must have already_rendered unset.
+    void redrawDamaged(const draw_task::draw_items_t &items)
+    {
+        forgetStaleWaiters(items);
+
+        std::vector<XRectangle> damage;
+        const auto addDamage = [&damage](const draw_task::screen_rect_t &rect) {
+            if (!rect.isEmpty())
+            {
+                damage.push_back(toXRectangle(rect));
+            }
+        };
+
+        for (auto iter = drawnBounds.begin(); iter != drawnBounds.end();)
+        {
+            if (items.count(iter->first) == 0)
+            {
+                addDamage(iter->second);
+                iter = drawnBounds.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
         }
-        assert(drawitem.svg.render);
-        if (!drawitem.svg.render)
+
+        for (const auto &[id, drawitem] : items)
         {
-            std::cerr << "SVG renderer was not set. It should not happen.\n";
+            if (!isDrawable(drawitem))
+            {
+                continue;
+            }
+            const auto old = drawnBounds.find(id);
+            const bool wasDrawn = old != drawnBounds.end();
+            if (drawitem.already_rendered && wasDrawn && old->second == drawitem.bounds)
+            {
+                continue;
+            }
+            const bool prepared = prepareItem(drawitem);
+            if (wasDrawn)
+            {
+                // Same content could be resent, so it was replaced by new object.
+                if (drawitem.already_rendered && old->second == drawitem.bounds)
+                {
+                    continue;
+                }
+                addDamage(old->second);
+                drawnBounds.erase(old);
+            }
+            if (prepared)
+            {
+                addDamage(drawitem.bounds);
+                drawnBounds[id] = drawitem.bounds;
+            }
+        }
+
+        if (fullRepaintRequired)
+        {
+            cleanGC(single_gc);
+            for (const auto &drawitem : items)
+            {
+                drawItem(drawitem.second);
+            }
+            fullRepaintRequired = false;
+            presentFull = true;
             return;
         }
-        drawitem.svg.render();
+
+        if (damage.empty())
+        {
+            return;
+        }
+
+        // Everything below is clipped to damaged area, so clean and composite touch only it.
+        const XserverRegion region =
+          XFixesCreateRegion(g_display, damage.data(), static_cast<int>(damage.size()));
+        XFixesSetGCClipRegion(g_display, single_gc, 0, 0, region);
+        XFixesSetPictureClipRegion(g_display, backBufferPicture, 0, 0, region);
+
+        cleanGC(single_gc);
+        for (const auto &drawitem : items)
+        {
+            const auto &bounds = drawitem.second.bounds;
+            const bool isDamaged =
+              std::any_of(damage.begin(), damage.end(), [&bounds](const XRectangle &rect) {
+                  return bounds.intersects({rect.x, rect.y, rect.width, rect.height});
+              });
+            if (isDamaged)
+            {
+                drawItem(drawitem.second);
+            }
+        }
+
+        XFixesSetGCClipRegion(g_display, single_gc, 0, 0, None);
+        XFixesSetPictureClipRegion(g_display, backBufferPicture, 0, 0, None);
+        XFixesDestroyRegion(g_display, region);
+
+        presentDamage.insert(presentDamage.end(), damage.begin(), damage.end());
     }
 
   private:
-    using TPixmapWithDims = std::tuple<TManagedPixmap, int, int>;
+    [[nodiscard]]
+    static bool isDrawable(const draw_task::drawitem_t &drawitem)
+    {
+        return drawitem.drawmode == draw_task::drawmode_t::svg
+               || drawitem.drawmode == draw_task::drawmode_t::text
+               || drawitem.drawmode == draw_task::drawmode_t::shape;
+    }
+
+    void drawItem(const draw_task::drawitem_t &drawitem)
+    {
+        if (!isDrawable(drawitem) || !prepareItem(drawitem))
+        {
+            return;
+        }
+        assert(drawitem.render);
+        if (!drawitem.render)
+        {
+            std::cerr << "Renderer was not set. It should not happen.\n";
+            return;
+        }
+        drawitem.render();
+    }
+
+    ///@returns XRender's picture of the window, it is created once.
+    Picture windowPicture()
+    {
+        if (!g_windowOpaqueDestination.IsInitialized())
+        {
+            XRenderPictFormat *pictFormat = XRenderFindVisualFormat(g_display, g_vinfo.visual);
+            g_windowOpaqueDestination = AllocateId<Picture>(
+              XRenderFreePicture, XRenderCreatePicture, g_display, g_win, pictFormat, 0, nullptr);
+        }
+        return g_windowOpaqueDestination;
+    }
     struct TXInitFreeCaller
     {
         NO_COPYMOVE(TXInitFreeCaller);
@@ -286,8 +743,75 @@ class XPrivateAccess
         }
     };
 
+    ///@brief Uploads premultiplied ARGB32 @p pixels into (@p x; @p y) of the @p drawable.
+    ///@returns false on failure.
+    bool UploadArgbPixels(Drawable drawable, int x, int y, std::uint32_t *pixels, int width,
+                          int height) const
+    {
+        if (shmImagePool->putImage(drawable, upload_gc, x, y, pixels, width, height))
+        {
+            return true;
+        }
+
+        auto ximage = AllocateOpaque<XImage>(
+          XMyDestroyImage, XCreateImage, g_display, g_vinfo.visual, kBitnessWithAlpha, ZPixmap, 0,
+          reinterpret_cast<char *>(pixels), width, height, kBitnessWithAlpha, 0); // NOLINT
+        if (!ximage)
+        {
+            std::cerr << "Failed to create XImage to upload pixmap." << std::endl;
+            return false;
+        }
+
+        XPutImage(g_display, drawable, upload_gc, ximage, 0, 0, x, y, width, height);
+        // Important: stopping freeing caller's memory.
+        ximage->data = nullptr;
+
+        return true;
+    }
+
+    ///@brief Uploads premultiplied ARGB32 @p pixels into the new pixmap.
+    ///@returns not initialized pixmap on failure.
     [[nodiscard]]
-    TPixmapWithDims RenderXPixmapFromSvgText(const std::string &svg, const std::string &css) const
+    TManagedPixmap UploadArgbPixmap(std::uint32_t *pixels, int width, int height) const
+    {
+        auto pixmap = AllocateId<Pixmap>(XFreePixmap, XCreatePixmap, g_display, g_win, width,
+                                         height, kBitnessWithAlpha);
+        if (!UploadArgbPixels(pixmap, 0, 0, pixels, width, height))
+        {
+            return {};
+        }
+        return pixmap;
+    }
+
+    ///@brief Uploads premultiplied ARGB32 @p pixels into the atlas if it is small enough, or into
+    /// own pixmap otherwise.
+    [[nodiscard]]
+    TXRaster UploadArgbRaster(std::uint32_t *pixels, int width, int height) const
+    {
+        if (auto slot = rasterAtlas->allocate(width, height))
+        {
+            if (!UploadArgbPixels(slot->pixmap(), slot->x, slot->y, pixels, width, height))
+            {
+                return {};
+            }
+            return {TManagedPixmap{}, {}, std::move(slot), width, height};
+        }
+
+        auto pixmap = UploadArgbPixmap(pixels, width, height);
+        if (!pixmap.IsInitialized())
+        {
+            return {};
+        }
+        auto picture = AllocateId<Picture>(XRenderFreePicture, XRenderCreatePicture, g_display,
+                                           pixmap, argbFormat, 0, nullptr);
+        return {std::move(pixmap), std::move(picture), nullptr, width, height};
+    }
+
+    ///@brief Renders SVG into CPU bitmap, it is thread-safe.
+    ///@returns null bitmap on failure or if @p isCancelled returned true.
+    [[nodiscard]]
+    static lunasvg::Bitmap RasterizeSvg(const std::string &svg, const std::string &css,
+                                        const std::function<bool()> &isCancelled)
     {
         try
         {
@@ -297,49 +821,203 @@ class XPrivateAccess
                 throw std::runtime_error("Empty SVG was provided.");
             }
 
+            // Lunasvg (plutovg) fills global font face cache and glyph caches of the faces lazily
+            // while text is rendered, so SVGs with text are rendered one at a time. SVGs without
+            // text touch no shared state and are rendered concurrently.
+            std::shared_lock sharedGrd(LunaFontsMutex(), std::defer_lock);
+            std::unique_lock uniqueGrd(LunaFontsMutex(), std::defer_lock);
+            if (svg.find("<text") != std::string::npos)
+            {
+                uniqueGrd.lock();
+            }
+            else
+            {
+                sharedGrd.lock();
+            }
             auto document = Document::loadFromData(svg);
             if (!css.empty())
             {
                 document->applyStyleSheet(css);
             }
+            if (isCancelled())
+            {
+                return {};
+            }
 
             auto bitmap = document->renderToBitmap();
             if (bitmap.isNull())
             {
                 std::cerr << "Failed to render SVG (NULL bitmap): " << std::endl
                           << svg << std::endl;
-                return std::make_tuple(TManagedPixmap{}, 0, 0);
             }
+            return bitmap;
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << e.what() << "\n" << svg << std::endl;
+        }
+        catch (...)
+        {
+            std::cerr << "Something unknown happened while rendering SVG:\n" << svg << std::endl;
+        }
+        return {};
+    }
 
-            constexpr int kBitnessWithAlpha = 32;
-            auto pixmap = AllocateId<Pixmap>(XFreePixmap, XCreatePixmap, g_display, g_win,
-                                             bitmap.width(), bitmap.height(), kBitnessWithAlpha);
-            auto ximage = AllocateOpaque<XImage>(
-              XMyDestroyImage, XCreateImage, g_display, g_vinfo.visual, kBitnessWithAlpha, ZPixmap,
-              0, reinterpret_cast<char *>(bitmap.data()), bitmap.width(), bitmap.height(), // NOLINT
-              kBitnessWithAlpha, 0);
-            if (!ximage)
+    ///@brief Makes @p drawitem wait for rasterization of its SVG, starts it by pool if nobody
+    /// started it yet. Job of the older generation of the same id is not waited anymore.
+    void requestRaster(const draw_task::drawitem_t &drawitem)
+    {
+        const auto &svg = drawitem.svg;
+        if (failedRasters.find(TSvgHash{}(svg)))
+        {
+            return;
+        }
+        auto &job = rasterJobs[svg];
+        const bool isNewJob = !job;
+        if (isNewJob)
+        {
+            job = std::make_shared<TRasterJob>();
+        }
+
+        auto &waiter = rasterWaiters[drawitem.id];
+        if (waiter.jobs.empty() || waiter.generation < drawitem.generation)
+        {
+            releaseJobs(waiter);
+            waiter.generation = drawitem.generation;
+        }
+        if (waiter.generation == drawitem.generation
+            && std::find(waiter.jobs.begin(), waiter.jobs.end(), job) == waiter.jobs.end())
+        {
+            waiter.jobs.push_back(job);
+            ++job->waiters;
+        }
+
+        if (!isNewJob)
+        {
+            return;
+        }
+        rasterPool->post([this, svg, job]() {
+            bool cancelled = false;
+            const auto isCancelled = [&cancelled, &job]() {
+                cancelled = cancelled || job->waiters == 0;
+                return cancelled;
+            };
+            TRasterized result{svg, {}, false};
+            if (!isCancelled())
+            {
+                // Installing of the new font waits for the text rendered by other threads, so it
+                // is done here instead of X thread.
+                InstallNormalFontFileToLuna(svg.fontFile);
+                result.bitmap = RasterizeSvg(svg.svg, svg.css, isCancelled);
+            }
+            result.cancelled = isCancelled();
+            {
+                const std::lock_guard grd(rasterizedMutex);
+                rasterized.push_back(std::move(result));
+            }
+            if (wakeup)
             {
-                std::cerr << "Failed to create XImage during SVG render." << std::endl;
-                return std::make_tuple(TManagedPixmap{}, 0, 0);
+                wakeup();
             }
+        });
+    }
 
-            XPutImage(g_display, pixmap, single_gc, ximage, 0, 0, 0, 0, bitmap.width(),
-                      bitmap.height());
-            // Important:stopping freeing lunasvg memory.
-            ximage->data = nullptr;
+    ///@brief Stops waiting for rasters by ids which are not in @p items anymore or were replaced
+    /// by the newer generation, which may not need raster at all.
+    void forgetStaleWaiters(const draw_task::draw_items_t &items)
+    {
+        for (auto iter = rasterWaiters.begin(); iter != rasterWaiters.end();)
+        {
+            const auto item = items.find(iter->first);
+            if (item == items.end() || item->second.generation != iter->second.generation)
+            {
+                releaseJobs(iter->second);
+                iter = rasterWaiters.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
 
-            return std::make_tuple(std::move(pixmap), bitmap.width(), bitmap.height());
+    static void releaseJobs(TRasterWaiter &waiter)
+    {
+        for (const auto &job : waiter.jobs)
+        {
+            --job->waiters;
         }
-        catch (std::exception &e)
+        waiter.jobs.clear();
+    }
+
+    ///@returns true if the current generation of @p drawitem waits for some raster.
+    [[nodiscard]]
+    bool isWaitingRaster(const draw_task::drawitem_t &drawitem) const
+    {
+        const auto it = rasterWaiters.find(drawitem.id);
+        return it != rasterWaiters.end() && it->second.generation == drawitem.generation
+               && !it->second.jobs.empty();
+    }
+
+    ///@brief Uploads SVGs rasterized by pool since last call into the cache.
+    ///@returns true if something was uploaded.
+    bool uploadRasterized()
+    {
+        std::vector<TRasterized> done;
         {
-            std::cerr << e.what() << "\n" << svg << std::endl;
+            const std::lock_guard grd(rasterizedMutex);
+            std::swap(done, rasterized);
         }
-        catch (...)
+
+        bool uploaded = false;
+        for (auto &result : done)
         {
-            std::cerr << "Something unknown happened while rendering SVG:\n" << svg << std::endl;
+            TRasterJobPtr job{nullptr};
+            if (const auto it = rasterJobs.find(result.svg); it != rasterJobs.end())
+            {
+                job = std::move(it->second);
+                rasterJobs.erase(it);
+            }
+            for (auto iter = rasterWaiters.begin(); iter != rasterWaiters.end();)
+            {
+                auto &jobs = iter->second.jobs;
+                jobs.erase(std::remove(jobs.begin(), jobs.end(), job), jobs.end());
+                iter = jobs.empty() ? rasterWaiters.erase(iter) : std::next(iter);
+            }
+            const bool isWanted = job && job->waiters > 0;
+            if (result.cancelled || !isWanted)
+            {
+                // Some id could start to wait after cancel, it will request raster again on redraw.
+                uploaded = uploaded || isWanted;
+                continue;
+            }
+
+            const auto &bitmap = result.bitmap;
+            auto raster = bitmap.isNull()
+                            ? nullptr
+                            : rasterCache->getOrRasterize(result.svg, [this, &bitmap]() {
+                                  // NOLINTNEXTLINE
+                                  return UploadArgbRaster(reinterpret_cast<std::uint32_t *>(
+                                                            bitmap.data()),
+                                                          bitmap.width(), bitmap.height());
+                              });
+            if (raster)
+            {
+                rasterJobs.erase(result.svg);
+                uploaded = true;
+            }
+            else if (bitmap.isNull())
+            {
+                // It will not be tried again while remembered.
+                failedRasters.insert(TSvgHash{}(result.svg), true);
+            }
+            else
+            {
+                // Upload could fail temporarily, so it is retried when item is redrawn.
+                std::cerr << "Failed to upload rendered SVG." << std::endl;
+            }
         }
-        return TPixmapWithDims{TManagedPixmap{}, 0, 0};
+        return uploaded;
     }
 
     void openDisplay()
@@ -424,6 +1102,18 @@ class XPrivateAccess
 
         // Show the window
         XMapWindow(g_display, g_win);
+
+        // Focus changes are reported by EWMH window managers as property of the root window.
+        activeWindowAtom = XInternAtom(g_display, "_NET_ACTIVE_WINDOW", False);
+        XSelectInput(g_display, g_root, PropertyChangeMask);
+    }
+
+    void createBackBuffer()
+    {
+        backBuffer = AllocateId<Pixmap>(XFreePixmap, XCreatePixmap, g_display, g_win, window_width,
+                                        window_height, kBitnessWithAlpha);
+        backBufferPicture = AllocateId<Picture>(XRenderFreePicture, XRenderCreatePicture, g_display,
+                                                backBuffer, argbFormat, 0, nullptr);
     }
 
     [[nodiscard]]
@@ -514,6 +1204,7 @@ void XOverlayOutput::cleanFrame()
 
 void XOverlayOutput::flushFrame()
 {
+    xserv->present();
     xserv->flush();
 }
 
@@ -526,7 +1217,7 @@ void XOverlayOutput::showVersionString(const std::string &version, const std::st
     task.text.text = version;
     task.x = 10;
     task.y = 10;
-    xserv->drawAsSvg(SvgBuilder(xserv->window_width, xserv->window_height, task).BuildSvgTask());
+    xserv->drawOver(task);
 }
 
 void XOverlayOutput::draw(const draw_task::drawitem_t &drawitem)
@@ -534,7 +1225,9 @@ void XOverlayOutput::draw(const draw_task::drawitem_t &drawitem)
     switch (drawitem.drawmode)
     {
         case draw_task::drawmode_t::svg:
-            xserv->drawAsSvg(drawitem);
+        case draw_task::drawmode_t::text:
+        case draw_task::drawmode_t::shape:
+            xserv->drawOver(drawitem);
             break;
         case draw_task::drawmode_t::idk:
             break;
@@ -544,6 +1237,31 @@ void XOverlayOutput::draw(const draw_task::drawitem_t &drawitem)
     }
 }
 
+void XOverlayOutput::redrawDamaged(const draw_task::draw_items_t &items)
+{
+    xserv->redrawDamaged(items);
+}
+
+int XOverlayOutput::getEventsFd() const
+{
+    return xserv->getEventsFd();
+}
+
+void XOverlayOutput::setWakeup(std::function<void()> wakeup)
+{
+    xserv->setWakeup(std::move(wakeup));
+}
+
+TProcessedEvents XOverlayOutput::processEvents()
+{
+    return xserv->processEvents();
+}
+
+bool XOverlayOutput::hasQueuedEvents() const
+{
+    return xserv->hasQueuedEvents();
+}
+
 std::string XOverlayOutput::getFocusedWindowBinaryPath() const
 {
     const auto pid = xserv->getFocusedWindowPid();
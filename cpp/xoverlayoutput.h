@@ -4,6 +4,7 @@
 #include "drawables.h"
 #include "layer_out.h"
 
+#include <functional>
 #include <memory>
 #include <string>
 
@@ -31,8 +32,15 @@ class XOverlayOutput : public OutputLayer
 
     void showVersionString(const std::string &version, const std::string &color) override;
     void draw(const draw_task::drawitem_t &drawitem) override;
+    void redrawDamaged(const draw_task::draw_items_t &items) override;
     [[nodiscard]]
     std::string getFocusedWindowBinaryPath() const override;
+    [[nodiscard]]
+    int getEventsFd() const override;
+    void setWakeup(std::function<void()> wakeup) override;
+    TProcessedEvents processEvents() override;
+    [[nodiscard]]
+    bool hasQueuedEvents() const override;
 
   private:
     std::shared_ptr<XPrivateAccess> xserv{nullptr};